@@ -1,7 +1,16 @@
 #pragma once
 
 #include <vector>
+#include <utility>
+#include <limits>
+#include <algorithm>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 #include "skew_matrix.h"
+#include "polynomial.h"
+#include "sturm_chain.h"
+#include "RANSAC.h"
 
 /*
     When q = Rp+T maps coordinate from p in camera system 1 to q in camera system 2.
@@ -163,4 +172,545 @@ inline bool solve_essential(const std::vector<Eigen::Vector2d> &pa, const std::v
     E = Nb*E*Na;
 
     return true;
-}
\ No newline at end of file
+}
+
+// polynomial of degree at most 3 in x, y, z, c[a][b][k] is the coefficient of x^a*y^b*z^k
+struct essential_cubic {
+    double c[4][4][4];
+
+    essential_cubic() {
+        std::fill(&c[0][0][0], &c[0][0][0] + 64, 0.0);
+    }
+
+    // x*X + y*Y + z*Z + W
+    static essential_cubic linear(double X, double Y, double Z, double W) {
+        essential_cubic p;
+        p.c[1][0][0] = X;
+        p.c[0][1][0] = Y;
+        p.c[0][0][1] = Z;
+        p.c[0][0][0] = W;
+        return p;
+    }
+
+    // terms beyond degree 3 are dropped, the products here never make them
+    essential_cubic operator*(const essential_cubic &q) const {
+        essential_cubic r;
+        for (int a = 0; a < 4; ++a) for (int b = 0; a + b < 4; ++b) for (int k = 0; a + b + k < 4; ++k) {
+            if (c[a][b][k] == 0.0) continue;
+            for (int d = 0; a + b + k + d < 4; ++d) for (int e = 0; a + b + k + d + e < 4; ++e) for (int f = 0; a + b + k + d + e + f < 4; ++f) {
+                r.c[a + d][b + e][k + f] += c[a][b][k] * q.c[d][e][f];
+            }
+        }
+        return r;
+    }
+
+    essential_cubic operator+(const essential_cubic &q) const {
+        essential_cubic r;
+        for (int i = 0; i < 64; ++i) {
+            (&r.c[0][0][0])[i] = (&c[0][0][0])[i] + (&q.c[0][0][0])[i];
+        }
+        return r;
+    }
+
+    essential_cubic operator*(double s) const {
+        essential_cubic r;
+        for (int i = 0; i < 64; ++i) {
+            (&r.c[0][0][0])[i] = (&c[0][0][0])[i] * s;
+        }
+        return r;
+    }
+};
+
+/*
+    The real roots of p in [lo, hi] by Sturm sequence bisection, each refined by bisection on p.
+*/
+inline void essential_real_roots(const polynomial<double> &p, const sturm_chain<double> &chain, double lo, double hi, std::vector<double> &roots, int depth = 0) {
+    size_t n = chain.root_in_range(lo, hi);
+    if (n == 0) {
+        return;
+    }
+    if (n == 1 || depth > 60) {
+        double flo = p(lo);
+        for (int i = 0; i < 100 && hi - lo > 1e-14*std::max(1.0, std::abs(lo)); ++i) {
+            double mid = 0.5*(lo + hi);
+            double fmid = p(mid);
+            if ((fmid < 0) == (flo < 0)) {
+                lo = mid;
+                flo = fmid;
+            }
+            else {
+                hi = mid;
+            }
+        }
+        roots.push_back(0.5*(lo + hi));
+        return;
+    }
+    double mid = 0.5*(lo + hi);
+    essential_real_roots(p, chain, lo, mid, roots, depth + 1);
+    essential_real_roots(p, chain, mid, hi, roots, depth + 1);
+}
+
+/*
+    An Efficient Solution to the Five-Point Relative Pose Problem, D. Nister, 2004.
+    Essential matrices E with pb[i]^T E pa[i] = 0 for five normalized correspondences.
+    E lies in the 4 dimensional null space of the epipolar constraints, the cubic constraints
+    det(E) = 0 and 2 E E^T E - trace(E E^T) E = 0 reduce to a degree 10 polynomial in one of
+    its coordinates, whose real roots are isolated with sturm_chain.
+    Writes up to 10 candidates, each of unit norm, and returns their count.
+*/
+inline int solve_essential_5pt(const Eigen::Vector2d *pa, const Eigen::Vector2d *pb, Eigen::Matrix3d *E) {
+    // epipolar constraints in the layout of solve_essential_normalized, padded to square
+    Eigen::Matrix<double, 9, 9> A = Eigen::Matrix<double, 9, 9>::Zero();
+    for (int i = 0; i < 5; ++i) {
+        A(i, 0) = pa[i](0)*pb[i](0);
+        A(i, 1) = pa[i](0)*pb[i](1);
+        A(i, 2) = pa[i](0);
+        A(i, 3) = pa[i](1)*pb[i](0);
+        A(i, 4) = pa[i](1)*pb[i](1);
+        A(i, 5) = pa[i](1);
+        A(i, 6) = pb[i](0);
+        A(i, 7) = pb[i](1);
+        A(i, 8) = 1;
+    }
+    Eigen::JacobiSVD<Eigen::Matrix<double, 9, 9>> svd(A, Eigen::ComputeFullV);
+    Eigen::Matrix<double, 9, 4> basis = svd.matrixV().rightCols<4>();
+    if (!(svd.singularValues()(4) > 1e-12*svd.singularValues()(0))) {
+        return 0;
+    }
+
+    // E = x*X + y*Y + z*Z + W, stored column major like the null vectors
+    essential_cubic e[3][3];
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            int k = j * 3 + i;
+            e[i][j] = essential_cubic::linear(basis(k, 0), basis(k, 1), basis(k, 2), basis(k, 3));
+        }
+    }
+
+    essential_cubic eet[3][3];
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            eet[i][j] = e[i][0] * e[j][0] + e[i][1] * e[j][1] + e[i][2] * e[j][2];
+        }
+    }
+    essential_cubic trace = eet[0][0] + eet[1][1] + eet[2][2];
+
+    essential_cubic constraints[10];
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            essential_cubic r;
+            for (int k = 0; k < 3; ++k) {
+                essential_cubic lhs = eet[i][k] * 2.0;
+                if (i == k) {
+                    lhs = lhs + trace * -1.0;
+                }
+                r = r + lhs * e[k][j];
+            }
+            constraints[i * 3 + j] = r;
+        }
+    }
+    constraints[9] = e[0][0] * (e[1][1] * e[2][2] + e[1][2] * e[2][1] * -1.0)
+        + e[0][1] * (e[1][2] * e[2][0] + e[1][0] * e[2][2] * -1.0)
+        + e[0][2] * (e[1][0] * e[2][1] + e[1][1] * e[2][0] * -1.0);
+
+    // monomials in the order of the paper: the first 10 are eliminated
+    static const int monomials[20][3] = {
+        { 3, 0, 0 }, { 0, 3, 0 }, { 2, 1, 0 }, { 1, 2, 0 }, { 2, 0, 1 }, { 2, 0, 0 }, { 0, 2, 1 }, { 0, 2, 0 }, { 1, 1, 1 }, { 1, 1, 0 },
+        { 1, 0, 2 }, { 1, 0, 1 }, { 1, 0, 0 }, { 0, 1, 2 }, { 0, 1, 1 }, { 0, 1, 0 }, { 0, 0, 3 }, { 0, 0, 2 }, { 0, 0, 1 }, { 0, 0, 0 }
+    };
+    Eigen::Matrix<double, 10, 20> M;
+    for (int r = 0; r < 10; ++r) {
+        for (int m = 0; m < 20; ++m) {
+            M(r, m) = constraints[r].c[monomials[m][0]][monomials[m][1]][monomials[m][2]];
+        }
+    }
+    Eigen::FullPivLU<Eigen::Matrix<double, 10, 10>> lu(M.leftCols<10>());
+    if (!lu.isInvertible()) {
+        return 0;
+    }
+    Eigen::Matrix<double, 10, 10> B = lu.solve(M.rightCols<10>());
+
+    // <k> = <e> - z<f>, <l> = <g> - z<h>, <m> = <i> - z<j> on the rows of x^2z, x^2, y^2z, y^2, xyz, xy
+    // b[r][0] and b[r][1] are the coefficients of x and y (cubic in z), b[r][2] the rest (quartic in z)
+    polynomial<double> b[3][3];
+    for (int r = 0; r < 3; ++r) {
+        const int upper = 4 + 2 * r, lower = 5 + 2 * r;
+        for (int v = 0; v < 2; ++v) {
+            // trailing columns of v*z^2, v*z, v
+            const int col = 3 * v;
+            b[r][v].set(3, -B(lower, col));
+            b[r][v].set(2, B(upper, col) - B(lower, col + 1));
+            b[r][v].set(1, B(upper, col + 1) - B(lower, col + 2));
+            b[r][v].set(0, B(upper, col + 2));
+        }
+        // trailing columns of z^3, z^2, z, 1
+        b[r][2].set(4, -B(lower, 6));
+        b[r][2].set(3, B(upper, 6) - B(lower, 7));
+        b[r][2].set(2, B(upper, 7) - B(lower, 8));
+        b[r][2].set(1, B(upper, 8) - B(lower, 9));
+        b[r][2].set(0, B(upper, 9));
+    }
+
+    polynomial<double> p1 = b[0][1] * b[1][2] - b[0][2] * b[1][1];
+    polynomial<double> p2 = b[0][2] * b[1][0] - b[0][0] * b[1][2];
+    polynomial<double> p3 = b[0][0] * b[1][1] - b[0][1] * b[1][0];
+    polynomial<double> n = p1 * b[2][0] + p2 * b[2][1] + p3 * b[2][2];
+    if (n.is_zero() || n.degree() == 0) {
+        return 0;
+    }
+
+    // Cauchy bound of the roots
+    double bound = 0.0;
+    for (polynomial<double>::e_type d = 0; d < n.degree(); ++d) {
+        bound = std::max(bound, std::abs(n.get(d) / n.get(n.degree())));
+    }
+    bound += 1.0;
+    sturm_chain<double> chain(n);
+    std::vector<double> roots;
+    essential_real_roots(n, chain, -bound, bound, roots);
+
+    int count = 0;
+    for (size_t i = 0; i < roots.size() && count < 10; ++i) {
+        double z = roots[i];
+        Eigen::Matrix3d Bz;
+        for (int r = 0; r < 3; ++r) {
+            for (int c = 0; c < 3; ++c) {
+                Bz(r, c) = b[r][c](z);
+            }
+        }
+        // (x, y, 1) spans the null space of B(z), take the best conditioned row pair
+        Eigen::Vector3d v = Bz.row(0).cross(Bz.row(1));
+        Eigen::Vector3d v1 = Bz.row(0).cross(Bz.row(2));
+        Eigen::Vector3d v2 = Bz.row(1).cross(Bz.row(2));
+        if (v1.norm() > v.norm()) v = v1;
+        if (v2.norm() > v.norm()) v = v2;
+        if (!(std::abs(v(2)) > 1e-14*v.norm())) {
+            continue;
+        }
+        double x = v(0) / v(2), y = v(1) / v(2);
+        Eigen::Matrix<double, 9, 1> ev = basis * Eigen::Vector4d(x, y, z, 1.0);
+        Eigen::Matrix3d candidate = Eigen::Map<Eigen::Matrix3d>(ev.data());
+        double norm = candidate.norm();
+        if (!(norm > 0) || !candidate.allFinite()) {
+            continue;
+        }
+        E[count++] = candidate / norm;
+    }
+    return count;
+}
+
+inline bool solve_essential_5pt(const std::vector<Eigen::Vector2d> &pa, const std::vector<Eigen::Vector2d> &pb, std::vector<Eigen::Matrix3d> &Es) {
+    if (pa.size() != 5 || pb.size() != 5) {
+        return false;
+    }
+    Eigen::Matrix3d candidates[10];
+    int n = solve_essential_5pt(pa.data(), pb.data(), candidates);
+    Es.assign(candidates, candidates + n);
+    return n > 0;
+}
+
+// first order approximation of the squared distance of (pa, pb) to the variety pb^T E pa = 0
+inline double sampson_error(const Eigen::Matrix3d &E, const Eigen::Vector2d &pa, const Eigen::Vector2d &pb) {
+    Eigen::Vector3d a = pa.homogeneous();
+    Eigen::Vector3d b = pb.homogeneous();
+    Eigen::Vector3d Ea = E*a;
+    Eigen::Vector3d Etb = E.transpose()*b;
+    double r = b.dot(Ea);
+    return r*r / (Ea.head<2>().squaredNorm() + Etb.head<2>().squaredNorm());
+}
+
+/*
+    Sampson errors (see sampson_error) of n correspondences given as coordinate arrays.
+    Uses AVX2 for four points at a time when compiled for it. The vector and scalar paths agree up to
+    rounding only, the compiler may fuse the scalar multiply-adds (e.g. with FMA enabled).
+*/
+inline void sampson_errors(const Eigen::Matrix3d &E, const double *ax, const double *ay, const double *bx, const double *by, size_t n, double *errors) {
+    const double e00 = E(0, 0), e01 = E(0, 1), e02 = E(0, 2);
+    const double e10 = E(1, 0), e11 = E(1, 1), e12 = E(1, 2);
+    const double e20 = E(2, 0), e21 = E(2, 1), e22 = E(2, 2);
+    size_t i = 0;
+#ifdef __AVX2__
+    const __m256d m00 = _mm256_set1_pd(e00), m01 = _mm256_set1_pd(e01), m02 = _mm256_set1_pd(e02);
+    const __m256d m10 = _mm256_set1_pd(e10), m11 = _mm256_set1_pd(e11), m12 = _mm256_set1_pd(e12);
+    const __m256d m20 = _mm256_set1_pd(e20), m21 = _mm256_set1_pd(e21), m22 = _mm256_set1_pd(e22);
+    for (; i + 4 <= n; i += 4) {
+        __m256d x = _mm256_loadu_pd(ax + i), y = _mm256_loadu_pd(ay + i);
+        __m256d u = _mm256_loadu_pd(bx + i), v = _mm256_loadu_pd(by + i);
+        __m256d ea0 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(m00, x), _mm256_mul_pd(m01, y)), m02);
+        __m256d ea1 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(m10, x), _mm256_mul_pd(m11, y)), m12);
+        __m256d ea2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(m20, x), _mm256_mul_pd(m21, y)), m22);
+        __m256d eb0 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(m00, u), _mm256_mul_pd(m10, v)), m20);
+        __m256d eb1 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(m01, u), _mm256_mul_pd(m11, v)), m21);
+        __m256d r = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(u, ea0), _mm256_mul_pd(v, ea1)), ea2);
+        __m256d d = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ea0, ea0), _mm256_mul_pd(ea1, ea1)), _mm256_add_pd(_mm256_mul_pd(eb0, eb0), _mm256_mul_pd(eb1, eb1)));
+        _mm256_storeu_pd(errors + i, _mm256_div_pd(_mm256_mul_pd(r, r), d));
+    }
+#endif
+    for (; i < n; ++i) {
+        double ea0 = e00*ax[i] + e01*ay[i] + e02;
+        double ea1 = e10*ax[i] + e11*ay[i] + e12;
+        double ea2 = e20*ax[i] + e21*ay[i] + e22;
+        double eb0 = e00*bx[i] + e10*by[i] + e20;
+        double eb1 = e01*bx[i] + e11*by[i] + e21;
+        double r = bx[i] * ea0 + by[i] * ea1 + ea2;
+        errors[i] = r*r / (ea0*ea0 + ea1*ea1 + eb0*eb0 + eb1*eb1);
+    }
+}
+
+// number of correspondences with sampson error below threshold, triangulated in front of both cameras by the pose q = Rp+T,
+// error receives the summed sampson error of the counted ones
+inline size_t count_in_front(const Eigen::Matrix3d &E, const Eigen::Matrix3d &R, const Eigen::Vector3d &T, const std::vector<Eigen::Vector2d> &pa, const std::vector<Eigen::Vector2d> &pb, double threshold, double &error) {
+    size_t count = 0;
+    error = 0.0;
+    for (size_t i = 0; i < pa.size(); ++i) {
+        double e = sampson_error(E, pa[i], pb[i]);
+        if (!(e < threshold)) {
+            continue;
+        }
+        // depths da, db with db*qb = da*R*qa + T, in the least squares sense
+        Eigen::Vector3d Rqa = R*pa[i].homogeneous();
+        Eigen::Vector3d qb = pb[i].homogeneous();
+        Eigen::Matrix<double, 3, 2> A;
+        A.col(0) = Rqa;
+        A.col(1) = -qb;
+        Eigen::Vector2d d = (A.transpose()*A).ldlt().solve(-A.transpose()*T);
+        if (d(0) > 0 && d(1) > 0) {
+            count++;
+            error += e;
+        }
+    }
+    return count;
+}
+
+/*
+    Picks the pose among the candidates of solve_essential_5pt or solve_essential, where most
+    correspondences agree with E up to threshold and lie in front of both cameras.
+    Each E gives two poses by decompose_essential and -E the other two.
+    The five points of the minimal sample are met by every candidate, pass further points to tell them apart.
+    Equal counts go to the smaller summed Sampson error over the counted points.
+    Returns false if no candidate places any point in front.
+*/
+inline bool select_essential(const std::vector<Eigen::Matrix3d> &Es, const std::vector<Eigen::Vector2d> &pa, const std::vector<Eigen::Vector2d> &pb, Eigen::Matrix3d &E, Eigen::Matrix3d &R, Eigen::Vector3d &T, double threshold = 1e-6) {
+    size_t best = 0;
+    double best_error = std::numeric_limits<double>::max();
+    for (size_t i = 0; i < Es.size(); ++i) {
+        for (int sign = -1; sign <= 1; sign += 2) {
+            Eigen::Matrix3d Rs[2];
+            Eigen::Vector3d Ts[2];
+            if (!decompose_essential(sign*Es[i], Rs[0], Rs[1], Ts[0], Ts[1])) {
+                continue;
+            }
+            for (int k = 0; k < 2; ++k) {
+                double error;
+                size_t count = count_in_front(Es[i], Rs[k], Ts[k], pa, pb, threshold, error);
+                if (count > best || (count == best && count > 0 && error < best_error)) {
+                    best = count;
+                    best_error = error;
+                    E = Es[i];
+                    R = Rs[k];
+                    T = Ts[k];
+                }
+            }
+        }
+    }
+    return best > 0;
+}
+
+/*
+    Refines E on correspondences it already fits by minimizing their Sampson errors with
+    Levenberg-Marquardt over E = [T]x R, a rotation update and a direction update of T,
+    so E stays an essential matrix throughout. With scale > 0 the Cauchy loss
+    scale*log(1 + e/scale) of each Sampson error e is minimized instead, so stray outliers
+    lose their pull. Returns false if E cannot be decomposed or there are fewer than 5 correspondences.
+*/
+inline bool refine_essential(const std::vector<Eigen::Vector2d> &pa, const std::vector<Eigen::Vector2d> &pb, Eigen::Matrix3d &E, double scale = 0.0, int iterations = 10) {
+    if (pa.size() < 5 || pa.size() != pb.size()) {
+        return false;
+    }
+    Eigen::Matrix3d R, R2;
+    Eigen::Vector3d T, T2;
+    if (!decompose_essential(E, R, R2, T, T2) || !(T.norm() > 0)) {
+        return false;
+    }
+    T.normalize();
+
+    // robust cost, residuals and their IRLS weights for the pose
+    auto evaluate = [&](const Eigen::Matrix3d &R, const Eigen::Vector3d &T, Eigen::VectorXd &residuals, Eigen::VectorXd &weights) {
+        Eigen::Matrix3d F = skew_matrix(T)*R;
+        double cost = 0.0;
+        for (size_t i = 0; i < pa.size(); ++i) {
+            Eigen::Vector3d a = pa[i].homogeneous();
+            Eigen::Vector3d b = pb[i].homogeneous();
+            Eigen::Vector3d Fa = F*a;
+            Eigen::Vector3d Ftb = F.transpose()*b;
+            double d = std::max(Fa.head<2>().squaredNorm() + Ftb.head<2>().squaredNorm(), 1e-300);
+            double s = b.dot(Fa) / sqrt(d);
+            residuals(i) = s;
+            if (scale > 0) {
+                weights(i) = 1.0 / (1.0 + s*s / scale);
+                cost += scale*log(1.0 + s*s / scale);
+            }
+            else {
+                weights(i) = 1.0;
+                cost += s*s;
+            }
+        }
+        return cost;
+    };
+    auto update = [](const Eigen::Matrix3d &R, const Eigen::Vector3d &T, const Eigen::Matrix<double, 5, 1> &delta, Eigen::Matrix3d &Ru, Eigen::Vector3d &Tu) {
+        Eigen::Vector3d w = delta.head<3>();
+        Ru = (w.norm() > 0 ? Eigen::Matrix3d(Eigen::AngleAxisd(w.norm(), w.normalized())) : Eigen::Matrix3d::Identity())*R;
+        // tangent basis of the unit sphere at T
+        Eigen::Vector3d t1 = T.unitOrthogonal();
+        Eigen::Vector3d t2 = T.cross(t1);
+        Tu = (T + delta(3)*t1 + delta(4)*t2).normalized();
+    };
+
+    const size_t n = pa.size();
+    Eigen::VectorXd residuals(n), weights(n), shifted(n), unused(n);
+    Eigen::Matrix<double, Eigen::Dynamic, 5> J(n, 5);
+    double cost = evaluate(R, T, residuals, weights);
+    double lambda = 1e-3;
+    const double h = 1e-7;
+    for (int k = 0; k < iterations; ++k) {
+        for (int j = 0; j < 5; ++j) {
+            Eigen::Matrix<double, 5, 1> delta = Eigen::Matrix<double, 5, 1>::Zero();
+            delta(j) = h;
+            Eigen::Matrix3d Rj;
+            Eigen::Vector3d Tj;
+            update(R, T, delta, Rj, Tj);
+            evaluate(Rj, Tj, shifted, unused);
+            J.col(j) = (shifted - residuals) / h;
+        }
+        Eigen::Matrix<double, 5, 5> JtWJ = J.transpose()*weights.asDiagonal()*J;
+        Eigen::Matrix<double, 5, 1> JtWr = J.transpose()*weights.asDiagonal()*residuals;
+        bool improved = false;
+        for (int attempt = 0; attempt < 10 && !improved; ++attempt) {
+            Eigen::Matrix<double, 5, 5> A = JtWJ;
+            A.diagonal() *= 1.0 + lambda;
+            Eigen::Matrix<double, 5, 1> delta = A.ldlt().solve(-JtWr);
+            Eigen::Matrix3d Ru;
+            Eigen::Vector3d Tu;
+            update(R, T, delta, Ru, Tu);
+            double c = evaluate(Ru, Tu, shifted, unused);
+            if (c < cost) {
+                R = Ru;
+                T = Tu;
+                cost = evaluate(R, T, residuals, weights);
+                lambda = std::max(lambda * 0.1, 1e-12);
+                improved = true;
+            }
+            else {
+                lambda *= 10.0;
+            }
+        }
+        if (!improved) {
+            break;
+        }
+    }
+    E = skew_matrix(T)*R;
+    return E.allFinite();
+}
+
+/*
+    RANSAC model (see RANSAC.h) of the essential matrix pb^T E pa = 0 for correspondences <pa, pb>
+    in normalized coordinates. A correspondence is an inlier when its Sampson error is below threshold.
+    Minimal samples go through solve_essential_5pt, the candidate agreeing with most of up to 100
+    evenly spaced points is kept, equal counts go to the smaller summed Sampson error over the agreeing points.
+    Larger sets (local optimization) refine the current E with refine_essential, the 8 point solver
+    only provides the start when E is not an estimate yet (not rank 2, e.g. the initial identity).
+*/
+struct essential_model {
+    typedef std::pair<Eigen::Vector2d, Eigen::Vector2d> point_type;
+    static const int n_fit = 5;
+
+    Eigen::Matrix3d E = Eigen::Matrix3d::Identity();
+    double threshold;
+
+    essential_model(double threshold = 1e-6) : threshold(threshold) {}
+
+    bool fit(const std::vector<point_type> &points, const std::vector<unsigned char> &mask) {
+        pa.clear();
+        pb.clear();
+        for (size_t i = 0; i < points.size(); ++i) {
+            if (mask[i]) {
+                pa.push_back(points[i].first);
+                pb.push_back(points[i].second);
+            }
+        }
+        if (pa.size() < n_fit) {
+            return false;
+        }
+        if (pa.size() < 8) {
+            Eigen::Matrix3d candidates[10];
+            int n = solve_essential_5pt(pa.data(), pb.data(), candidates);
+            size_t stride = std::max<size_t>(1, points.size() / 100);
+            size_t best = 0;
+            double best_error = 0.0;
+            for (int k = 0; k < n; ++k) {
+                size_t count = 0;
+                double error = 0.0;
+                for (size_t i = 0; i < points.size(); i += stride) {
+                    double e = sampson_error(candidates[k], points[i].first, points[i].second);
+                    if (e < threshold) {
+                        count++;
+                        error += e;
+                    }
+                }
+                if (k == 0 || count > best || (count == best && error < best_error)) {
+                    best = count;
+                    best_error = error;
+                    E = candidates[k];
+                }
+            }
+            return n > 0;
+        }
+        // start from the current E when it is an estimate already, i.e. rank 2
+        Eigen::Matrix3d refined = E;
+        Eigen::Vector3d s = E.jacobiSvd().singularValues();
+        if (!(s(2) < 1e-6*s(0))) {
+            Eigen::Matrix3d solved;
+            if (!solve_essential(pa, pb, solved) || !fix_essential(solved, refined)) {
+                return false;
+            }
+        }
+        if (!refine_essential(pa, pb, refined, threshold)) {
+            return false;
+        }
+        E = refined;
+        return true;
+    }
+
+    double error(const point_type &point) const {
+        return sampson_error(E, point.first, point.second);
+    }
+
+    bool consensus(const point_type &point) {
+        return error(point) < threshold;
+    }
+
+    void consensus_batch(const point_type *points, size_t n, unsigned char *mask) {
+        double errors[256];
+        for (size_t first = 0; first < n; first += 256) {
+            size_t m = std::min(n - first, size_t(256));
+            error_batch(points + first, m, errors);
+            for (size_t i = 0; i < m; ++i) {
+                mask[first + i] = errors[i] < threshold ? 1 : 0;
+            }
+        }
+    }
+
+    void error_batch(const point_type *points, size_t n, double *errors) {
+        ransac_soa_block<double, 4> block;
+        for (size_t first = 0; first < n; first += block.capacity) {
+            block.load(points + first, n - first, [](const point_type &p, double *v) {
+                v[0] = p.first.x(); v[1] = p.first.y(); v[2] = p.second.x(); v[3] = p.second.y();
+            });
+            sampson_errors(E, block[0], block[1], block[2], block[3], block.size, errors + first);
+        }
+    }
+
+private:
+    std::vector<Eigen::Vector2d> pa;
+    std::vector<Eigen::Vector2d> pb;
+};
@@ -0,0 +1,752 @@
+#pragma once
+
+/*
+    A compact half-edge triangle mesh.
+    Implements the subset of the OpenMesh TriMesh interface used by remesher, under the same names.
+
+    Elements are int32 indices into contiguous arrays, one array per attribute.
+    Halfedges of an edge are 2*e and 2*e+1, so opposite and edge handles are computed, not stored.
+    Collapses and flips only touch the elements around the edge, so operations on disjoint
+    regions can run in parallel. Deleted elements are flagged until garbage_collection().
+
+    import_mesh()/export_mesh() copy vertices and faces from/to an OpenMesh style mesh.
+*/
+
+#include <cmath>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <unordered_map>
+
+class halfedge_mesh {
+public:
+    struct Point {
+        float v[3];
+
+        Point() {}
+        Point(float x, float y, float z) {
+            v[0] = x; v[1] = y; v[2] = z;
+        }
+
+        float &operator[](int i) { return v[i]; }
+        const float &operator[](int i) const { return v[i]; }
+
+        Point &operator+=(const Point &p) { v[0] += p.v[0]; v[1] += p.v[1]; v[2] += p.v[2]; return *this; }
+        Point &operator-=(const Point &p) { v[0] -= p.v[0]; v[1] -= p.v[1]; v[2] -= p.v[2]; return *this; }
+        Point &operator*=(float s) { v[0] *= s; v[1] *= s; v[2] *= s; return *this; }
+        Point &operator/=(float s) { v[0] /= s; v[1] /= s; v[2] /= s; return *this; }
+
+        Point operator+(const Point &p) const { return Point(*this) += p; }
+        Point operator-(const Point &p) const { return Point(*this) -= p; }
+        Point operator*(float s) const { return Point(*this) *= s; }
+        Point operator/(float s) const { return Point(*this) /= s; }
+        friend Point operator*(float s, const Point &p) { return p*s; }
+
+        float sqrnorm() const { return v[0] * v[0] + v[1] * v[1] + v[2] * v[2]; }
+        float norm() const { return std::sqrt(sqrnorm()); }
+
+        friend float dot(const Point &a, const Point &b) {
+            return a.v[0] * b.v[0] + a.v[1] * b.v[1] + a.v[2] * b.v[2];
+        }
+
+        friend Point cross(const Point &a, const Point &b) {
+            return Point(a.v[1] * b.v[2] - a.v[2] * b.v[1], a.v[2] * b.v[0] - a.v[0] * b.v[2], a.v[0] * b.v[1] - a.v[1] * b.v[0]);
+        }
+    };
+    typedef Point Normal;
+
+    class BaseHandle {
+    public:
+        explicit BaseHandle(int idx = -1) : m_idx(idx) {}
+        int idx() const { return m_idx; }
+        bool is_valid() const { return m_idx >= 0; }
+        bool operator==(const BaseHandle &h) const { return m_idx == h.m_idx; }
+        bool operator!=(const BaseHandle &h) const { return m_idx != h.m_idx; }
+        bool operator<(const BaseHandle &h) const { return m_idx < h.m_idx; }
+    private:
+        int m_idx;
+    };
+
+    struct VertexHandle : BaseHandle { explicit VertexHandle(int idx = -1) : BaseHandle(idx) {} };
+    struct HalfedgeHandle : BaseHandle { explicit HalfedgeHandle(int idx = -1) : BaseHandle(idx) {} };
+    struct EdgeHandle : BaseHandle { explicit EdgeHandle(int idx = -1) : BaseHandle(idx) {} };
+    struct FaceHandle : BaseHandle { explicit FaceHandle(int idx = -1) : BaseHandle(idx) {} };
+
+    template <typename T>
+    struct VPropHandleT : BaseHandle { explicit VPropHandleT(int idx = -1) : BaseHandle(idx) {} };
+
+    // view of the status bits of one element, Bits is const for read-only access
+    template <typename Bits>
+    class status_ref {
+    public:
+        explicit status_ref(Bits &bits) : m_bits(bits) {}
+        bool deleted() const { return (m_bits & status_deleted) != 0; }
+        bool feature() const { return (m_bits & status_feature) != 0; }
+        void set_deleted(bool b) { set(status_deleted, b); }
+        void set_feature(bool b) { set(status_feature, b); }
+    private:
+        void set(unsigned char bit, bool b) {
+            m_bits = (unsigned char)(b ? (m_bits | bit) : (m_bits & ~bit));
+        }
+        Bits &m_bits;
+    };
+
+    halfedge_mesh() {}
+
+    void clear() {
+        m_points.clear();
+        m_vertex_normals.clear();
+        m_vertex_halfedges.clear();
+        m_vertex_status.clear();
+        m_to_vertex.clear();
+        m_next.clear();
+        m_prev.clear();
+        m_face.clear();
+        m_edge_status.clear();
+        m_face_halfedges.clear();
+        m_face_normals.clear();
+        m_face_status.clear();
+        resize_properties();
+    }
+
+    /*
+        Builds the mesh from a triangle list with ccw vertex order.
+        Fails when an edge has more than two faces or two faces disagree on orientation.
+        A vertex joining several fans of faces fails too, unless copies is given: the vertex is then
+        split into one vertex per fan, and copies receives the source of every appended vertex.
+    */
+    bool build(const std::vector<Point> &points, const std::vector<int> &triangles, std::vector<int> *copies = nullptr) {
+        clear();
+        for (size_t i = 0; i < points.size(); ++i) {
+            add_vertex(points[i]);
+        }
+
+        std::unordered_map<std::uint64_t, int> edges;
+        edges.reserve(triangles.size());
+        for (size_t t = 0; t + 2 < triangles.size(); t += 3) {
+            int fh = (int)m_face_halfedges.size();
+            m_face_halfedges.push_back(-1);
+            m_face_normals.emplace_back(0.0f, 0.0f, 0.0f);
+            m_face_status.push_back(0);
+            int hs[3];
+            for (int k = 0; k < 3; ++k) {
+                int from = triangles[t + k];
+                int to = triangles[t + (k + 1) % 3];
+                std::uint64_t key = ((std::uint64_t)std::min(from, to) << 32) | (std::uint32_t)std::max(from, to);
+                auto it = edges.find(key);
+                int h;
+                if (it == edges.end()) {
+                    h = new_edge(from, to);
+                    edges.emplace(key, h >> 1);
+                }
+                else {
+                    h = 2 * it->second;
+                    if (m_to_vertex[h] != to) h ^= 1;
+                    if (m_to_vertex[h] != to || m_face[h] >= 0) return false;
+                }
+                m_face[h] = fh;
+                hs[k] = h;
+            }
+            for (int k = 0; k < 3; ++k) {
+                set_next(hs[k], hs[(k + 1) % 3]);
+                m_vertex_halfedges[m_to_vertex[hs[(k + 2) % 3]]] = hs[k];
+            }
+            m_face_halfedges[fh] = hs[0];
+        }
+
+        // link boundary halfedges into loops, boundary vertices keep their boundary halfedge
+        if (copies) copies->clear();
+        std::vector<int> boundary_out(m_points.size(), -1);
+        for (int h = 0; h < (int)m_to_vertex.size(); ++h) {
+            if (m_face[h] < 0) {
+                int from = m_to_vertex[h ^ 1];
+                if (boundary_out[from] >= 0) {
+                    if (!copies) return false;
+                    copies->push_back(from);
+                    m_vertex_halfedges[from] = boundary_out[from];
+                    from = split_fan(h);
+                    boundary_out.push_back(-1);
+                }
+                boundary_out[from] = h;
+                m_vertex_halfedges[from] = h;
+            }
+        }
+        for (int h = 0; h < (int)m_to_vertex.size(); ++h) {
+            if (m_face[h] < 0) {
+                set_next(h, boundary_out[m_to_vertex[h]]);
+            }
+        }
+        return true;
+    }
+
+    size_t n_vertices() const { return m_points.size(); }
+    size_t n_halfedges() const { return m_to_vertex.size(); }
+    size_t n_edges() const { return m_edge_status.size(); }
+    size_t n_faces() const { return m_face_halfedges.size(); }
+
+    // normals and status are always present
+    void request_vertex_normals() {}
+    void request_face_normals() {}
+    void request_vertex_status() {}
+    void request_edge_status() {}
+    void request_face_status() {}
+
+    VertexHandle add_vertex(const Point &p) {
+        m_points.push_back(p);
+        m_vertex_normals.emplace_back(0.0f, 0.0f, 0.0f);
+        m_vertex_halfedges.push_back(-1);
+        m_vertex_status.push_back(0);
+        resize_properties();
+        return VertexHandle((int)m_points.size() - 1);
+    }
+
+    const Point &point(const VertexHandle &vh) const { return m_points[vh.idx()]; }
+    void set_point(const VertexHandle &vh, const Point &p) { m_points[vh.idx()] = p; }
+    const Normal &normal(const VertexHandle &vh) const { return m_vertex_normals[vh.idx()]; }
+    void set_normal(const VertexHandle &vh, const Normal &n) { m_vertex_normals[vh.idx()] = n; }
+    const Normal &normal(const FaceHandle &fh) const { return m_face_normals[fh.idx()]; }
+    void set_normal(const FaceHandle &fh, const Normal &n) { m_face_normals[fh.idx()] = n; }
+
+    status_ref<unsigned char> status(const VertexHandle &vh) { return status_ref<unsigned char>(m_vertex_status[vh.idx()]); }
+    status_ref<unsigned char> status(const EdgeHandle &eh) { return status_ref<unsigned char>(m_edge_status[eh.idx()]); }
+    status_ref<unsigned char> status(const FaceHandle &fh) { return status_ref<unsigned char>(m_face_status[fh.idx()]); }
+    status_ref<const unsigned char> status(const VertexHandle &vh) const { return status_ref<const unsigned char>(m_vertex_status[vh.idx()]); }
+    status_ref<const unsigned char> status(const EdgeHandle &eh) const { return status_ref<const unsigned char>(m_edge_status[eh.idx()]); }
+    status_ref<const unsigned char> status(const FaceHandle &fh) const { return status_ref<const unsigned char>(m_face_status[fh.idx()]); }
+
+    HalfedgeHandle halfedge_handle(const VertexHandle &vh) const { return HalfedgeHandle(m_vertex_halfedges[vh.idx()]); }
+    HalfedgeHandle halfedge_handle(const FaceHandle &fh) const { return HalfedgeHandle(m_face_halfedges[fh.idx()]); }
+    HalfedgeHandle halfedge_handle(const EdgeHandle &eh, int i) const { return HalfedgeHandle(2 * eh.idx() + i); }
+    HalfedgeHandle next_halfedge_handle(const HalfedgeHandle &heh) const { return HalfedgeHandle(m_next[heh.idx()]); }
+    HalfedgeHandle prev_halfedge_handle(const HalfedgeHandle &heh) const { return HalfedgeHandle(m_prev[heh.idx()]); }
+    HalfedgeHandle opposite_halfedge_handle(const HalfedgeHandle &heh) const { return HalfedgeHandle(heh.idx() ^ 1); }
+    VertexHandle to_vertex_handle(const HalfedgeHandle &heh) const { return VertexHandle(m_to_vertex[heh.idx()]); }
+    VertexHandle from_vertex_handle(const HalfedgeHandle &heh) const { return VertexHandle(m_to_vertex[heh.idx() ^ 1]); }
+    FaceHandle face_handle(const HalfedgeHandle &heh) const { return FaceHandle(m_face[heh.idx()]); }
+    EdgeHandle edge_handle(const HalfedgeHandle &heh) const { return EdgeHandle(heh.idx() >> 1); }
+
+    // vertex opposite to the halfedge in its face, invalid on the boundary
+    VertexHandle opposite_vh(const HalfedgeHandle &heh) const {
+        return is_boundary(heh) ? VertexHandle() : VertexHandle(m_to_vertex[m_next[heh.idx()]]);
+    }
+
+    bool is_boundary(const HalfedgeHandle &heh) const { return m_face[heh.idx()] < 0; }
+    bool is_boundary(const EdgeHandle &eh) const { return m_face[2 * eh.idx()] < 0 || m_face[2 * eh.idx() + 1] < 0; }
+
+    // isolated vertices count as boundary, as in OpenMesh
+    bool is_boundary(const VertexHandle &vh) const {
+        int h = m_vertex_halfedges[vh.idx()];
+        return h < 0 || m_face[h] < 0;
+    }
+
+    bool is_isolated(const VertexHandle &vh) const { return m_vertex_halfedges[vh.idx()] < 0; }
+
+    // at most one gap in the fan of faces
+    bool is_manifold(const VertexHandle &vh) const {
+        int n_gaps = 0;
+        for_each_outgoing(vh.idx(), [this, &n_gaps](int h) {
+            if (m_face[h] < 0) n_gaps++;
+        });
+        return n_gaps < 2;
+    }
+
+    unsigned int valence(const VertexHandle &vh) const {
+        unsigned int n = 0;
+        for_each_outgoing(vh.idx(), [&n](int) { n++; });
+        return n;
+    }
+
+    float calc_edge_sqr_length(const EdgeHandle &eh) const {
+        return (m_points[m_to_vertex[2 * eh.idx()]] - m_points[m_to_vertex[2 * eh.idx() + 1]]).sqrnorm();
+    }
+
+    Normal calc_face_normal(const FaceHandle &fh) const {
+        int h0 = m_face_halfedges[fh.idx()];
+        int h1 = m_next[h0];
+        int h2 = m_next[h1];
+        const Point &p0 = m_points[m_to_vertex[h0]];
+        Normal n = cross(m_points[m_to_vertex[h1]] - p0, m_points[m_to_vertex[h2]] - p0);
+        float len = n.norm();
+        return len > 0.0f ? n / len : n;
+    }
+
+    // average of the stored normals of the incident faces
+    Normal calc_vertex_normal(const VertexHandle &vh) const {
+        Normal n(0.0f, 0.0f, 0.0f);
+        for_each_outgoing(vh.idx(), [this, &n](int h) {
+            if (m_face[h] >= 0) n += m_face_normals[m_face[h]];
+        });
+        float len = n.norm();
+        return len > 0.0f ? n / len : n;
+    }
+
+    void update_face_normals() {
+        for (size_t f = 0; f < n_faces(); ++f) {
+            if (!(m_face_status[f] & status_deleted)) {
+                m_face_normals[f] = calc_face_normal(FaceHandle((int)f));
+            }
+        }
+    }
+
+    void update_vertex_normals() {
+        for (size_t v = 0; v < n_vertices(); ++v) {
+            m_vertex_normals[v] = calc_vertex_normal(VertexHandle((int)v));
+        }
+    }
+
+    void update_normals() {
+        update_face_normals();
+        update_vertex_normals();
+    }
+
+    template <typename T>
+    void add_property(VPropHandleT<T> &ph) {
+        ph = VPropHandleT<T>((int)m_vertex_properties.size());
+        m_vertex_properties.emplace_back(new vertex_property<T>());
+        m_vertex_properties.back()->resize(n_vertices());
+    }
+
+    template <typename T>
+    T &property(const VPropHandleT<T> &ph, const VertexHandle &vh) {
+        return static_cast<vertex_property<T> &>(*m_vertex_properties[ph.idx()]).data[vh.idx()];
+    }
+
+    template <typename T>
+    const T &property(const VPropHandleT<T> &ph, const VertexHandle &vh) const {
+        return static_cast<const vertex_property<T> &>(*m_vertex_properties[ph.idx()]).data[vh.idx()];
+    }
+
+    // the flipped edge must not exist already
+    bool is_flip_ok(const EdgeHandle &eh) const {
+        if (is_boundary(eh)) return false;
+        int a = m_to_vertex[m_next[2 * eh.idx()]];
+        int b = m_to_vertex[m_next[2 * eh.idx() + 1]];
+        if (a == b) return false;
+        bool ok = true;
+        for_each_outgoing(a, [this, b, &ok](int h) {
+            if (m_to_vertex[h] == b) ok = false;
+        });
+        return ok;
+    }
+
+    void flip(const EdgeHandle &eh) {
+        int a0 = 2 * eh.idx();
+        int b0 = a0 + 1;
+        int a1 = m_next[a0];
+        int a2 = m_next[a1];
+        int b1 = m_next[b0];
+        int b2 = m_next[b1];
+        int va0 = m_to_vertex[a0];
+        int va1 = m_to_vertex[a1];
+        int vb0 = m_to_vertex[b0];
+        int vb1 = m_to_vertex[b1];
+        int fa = m_face[a0];
+        int fb = m_face[b0];
+
+        m_to_vertex[a0] = va1;
+        m_to_vertex[b0] = vb1;
+
+        set_next(a0, a2);
+        set_next(a2, b1);
+        set_next(b1, a0);
+        set_next(b0, b2);
+        set_next(b2, a1);
+        set_next(a1, b0);
+
+        m_face[a1] = fb;
+        m_face[b1] = fa;
+        m_face_halfedges[fa] = a0;
+        m_face_halfedges[fb] = b0;
+
+        if (m_vertex_halfedges[va0] == b0) m_vertex_halfedges[va0] = a1;
+        if (m_vertex_halfedges[vb0] == a0) m_vertex_halfedges[vb0] = b1;
+    }
+
+    /*
+        Collapsing from(heh) into to(heh) is topologically safe when the one-rings of the two vertices
+        only share the vertices opposite to the edge, and no face would lose both of its other edges to the boundary.
+    */
+    bool is_collapse_ok(const HalfedgeHandle &heh) const {
+        int h = heh.idx();
+        int o = h ^ 1;
+        int v0 = m_to_vertex[o];
+        int v1 = m_to_vertex[h];
+        if ((m_vertex_status[v0] & status_deleted) || (m_vertex_status[v1] & status_deleted)) return false;
+
+        int vl = -1, vr = -1;
+        if (m_face[h] >= 0) {
+            int h1 = m_next[h];
+            int h2 = m_next[h1];
+            vl = m_to_vertex[h1];
+            if (m_face[h1 ^ 1] < 0 && m_face[h2 ^ 1] < 0) return false;
+        }
+        if (m_face[o] >= 0) {
+            int o1 = m_next[o];
+            int o2 = m_next[o1];
+            vr = m_to_vertex[o1];
+            if (m_face[o1 ^ 1] < 0 && m_face[o2 ^ 1] < 0) return false;
+        }
+        if (vl == vr) return false;
+        if (is_boundary(VertexHandle(v0)) && is_boundary(VertexHandle(v1)) && m_face[h] >= 0 && m_face[o] >= 0) return false;
+
+        bool ok = true;
+        for_each_outgoing(v0, [this, v1, vl, vr, &ok](int h0) {
+            int v = m_to_vertex[h0];
+            if (v == v1 || v == vl || v == vr) return;
+            for_each_outgoing(v1, [this, v, &ok](int h1) {
+                if (m_to_vertex[h1] == v) ok = false;
+            });
+        });
+        return ok;
+    }
+
+    // moves from(heh) into to(heh), removing the edge and its faces
+    void collapse(const HalfedgeHandle &heh) {
+        int h = heh.idx();
+        int hn = m_next[h];
+        int hp = m_prev[h];
+        int o = h ^ 1;
+        int on = m_next[o];
+        int op = m_prev[o];
+        int fh = m_face[h];
+        int fo = m_face[o];
+        int vh = m_to_vertex[h];
+        int vo = m_to_vertex[o];
+
+        for_each_outgoing(vo, [this, vh](int h0) {
+            m_to_vertex[h0 ^ 1] = vh;
+        });
+
+        set_next(hp, hn);
+        set_next(op, on);
+        if (fh >= 0) m_face_halfedges[fh] = hn;
+        if (fo >= 0) m_face_halfedges[fo] = on;
+
+        if (m_vertex_halfedges[vh] == o) m_vertex_halfedges[vh] = hn;
+        adjust_outgoing_halfedge(vh);
+        m_vertex_halfedges[vo] = -1;
+
+        m_edge_status[h >> 1] |= status_deleted;
+        m_vertex_status[vo] |= status_deleted;
+
+        // the faces of the edge have degenerated to two-sided loops
+        if (m_next[m_next[hn]] == hn) collapse_loop(m_next[hn]);
+        if (m_next[m_next[on]] == on) collapse_loop(m_next[on]);
+    }
+
+    // splits the edge and its faces at a new vertex placed at p
+    VertexHandle split(const EdgeHandle &eh, const Point &p) {
+        int vh = add_vertex(p).idx();
+        int h0 = 2 * eh.idx();
+        int o0 = h0 + 1;
+        int v2 = m_to_vertex[o0];
+        int e1 = new_edge(vh, v2);
+        int t1 = e1 ^ 1;
+        int f0 = m_face[h0];
+        int f3 = m_face[o0];
+
+        m_vertex_halfedges[vh] = h0;
+        m_to_vertex[o0] = vh;
+
+        if (f0 >= 0) {
+            int h1 = m_next[h0];
+            int h2 = m_next[h1];
+            int v1 = m_to_vertex[h1];
+            int e0 = new_edge(vh, v1);
+            int t0 = e0 ^ 1;
+            int f1 = new_face();
+            m_face_halfedges[f0] = h0;
+            m_face_halfedges[f1] = h2;
+            m_face[h1] = f0; m_face[t0] = f0; m_face[h0] = f0;
+            m_face[h2] = f1; m_face[t1] = f1; m_face[e0] = f1;
+            set_next(h0, h1); set_next(h1, t0); set_next(t0, h0);
+            set_next(e0, h2); set_next(h2, t1); set_next(t1, e0);
+        }
+        else {
+            set_next(m_prev[h0], t1);
+            set_next(t1, h0);
+        }
+
+        if (f3 >= 0) {
+            int o1 = m_next[o0];
+            int o2 = m_next[o1];
+            int v3 = m_to_vertex[o1];
+            int e2 = new_edge(vh, v3);
+            int t2 = e2 ^ 1;
+            int f2 = new_face();
+            m_face_halfedges[f2] = o1;
+            m_face_halfedges[f3] = o0;
+            m_face[o1] = f2; m_face[t2] = f2; m_face[e1] = f2;
+            m_face[o2] = f3; m_face[o0] = f3; m_face[e2] = f3;
+            set_next(e1, o1); set_next(o1, t2); set_next(t2, e1);
+            set_next(o0, e2); set_next(e2, o2); set_next(o2, o0);
+        }
+        else {
+            set_next(e1, m_next[o0]);
+            set_next(o0, e1);
+            m_vertex_halfedges[vh] = e1;
+        }
+
+        if (m_vertex_halfedges[v2] == h0) m_vertex_halfedges[v2] = t1;
+        return VertexHandle(vh);
+    }
+
+    // removes deleted elements, handles held by the caller are invalidated
+    void garbage_collection() {
+        std::vector<int> vmap = compact_map(m_vertex_status);
+        std::vector<int> emap = compact_map(m_edge_status);
+        std::vector<int> fmap = compact_map(m_face_status);
+        auto hmap = [&emap](int h) {
+            return h < 0 ? -1 : 2 * emap[h >> 1] + (h & 1);
+        };
+
+        size_t n_v = 0;
+        for (size_t v = 0; v < vmap.size(); ++v) {
+            if (vmap[v] < 0) continue;
+            n_v = vmap[v] + 1;
+            m_points[vmap[v]] = m_points[v];
+            m_vertex_normals[vmap[v]] = m_vertex_normals[v];
+            m_vertex_halfedges[vmap[v]] = hmap(m_vertex_halfedges[v]);
+            m_vertex_status[vmap[v]] = m_vertex_status[v];
+        }
+        m_points.resize(n_v);
+        m_vertex_normals.resize(n_v);
+        m_vertex_halfedges.resize(n_v);
+        m_vertex_status.resize(n_v);
+        for (size_t i = 0; i < m_vertex_properties.size(); ++i) {
+            m_vertex_properties[i]->compact(vmap, n_v);
+        }
+
+        size_t n_e = 0;
+        for (size_t e = 0; e < emap.size(); ++e) {
+            if (emap[e] < 0) continue;
+            n_e = emap[e] + 1;
+            m_edge_status[emap[e]] = m_edge_status[e];
+            for (int i = 0; i < 2; ++i) {
+                int h = 2 * (int)e + i;
+                int nh = 2 * emap[e] + i;
+                m_to_vertex[nh] = vmap[m_to_vertex[h]];
+                m_next[nh] = hmap(m_next[h]);
+                m_prev[nh] = hmap(m_prev[h]);
+                m_face[nh] = m_face[h] < 0 ? -1 : fmap[m_face[h]];
+            }
+        }
+        m_edge_status.resize(n_e);
+        m_to_vertex.resize(2 * n_e);
+        m_next.resize(2 * n_e);
+        m_prev.resize(2 * n_e);
+        m_face.resize(2 * n_e);
+
+        size_t n_f = 0;
+        for (size_t f = 0; f < fmap.size(); ++f) {
+            if (fmap[f] < 0) continue;
+            n_f = fmap[f] + 1;
+            m_face_halfedges[fmap[f]] = hmap(m_face_halfedges[f]);
+            m_face_normals[fmap[f]] = m_face_normals[f];
+            m_face_status[fmap[f]] = m_face_status[f];
+        }
+        m_face_halfedges.resize(n_f);
+        m_face_normals.resize(n_f);
+        m_face_status.resize(n_f);
+    }
+
+    // bytes held by the mesh arrays, properties excluded
+    size_t memory_usage() const {
+        return m_points.capacity() * sizeof(Point) + m_vertex_normals.capacity() * sizeof(Normal)
+            + m_vertex_halfedges.capacity() * sizeof(int) + m_vertex_status.capacity()
+            + (m_to_vertex.capacity() + m_next.capacity() + m_prev.capacity() + m_face.capacity()) * sizeof(int)
+            + m_edge_status.capacity()
+            + m_face_halfedges.capacity() * sizeof(int) + m_face_normals.capacity() * sizeof(Normal) + m_face_status.capacity();
+    }
+
+private:
+    static const unsigned char status_deleted = 1;
+    static const unsigned char status_feature = 2;
+
+    class vertex_property_base {
+    public:
+        virtual ~vertex_property_base() {}
+        virtual void resize(size_t n) = 0;
+        virtual void compact(const std::vector<int> &map, size_t n) = 0;
+    };
+
+    template <typename T>
+    class vertex_property : public vertex_property_base {
+    public:
+        void resize(size_t n) override {
+            data.resize(n);
+        }
+
+        void compact(const std::vector<int> &map, size_t n) override {
+            for (size_t i = 0; i < map.size(); ++i) {
+                if (map[i] >= 0) data[map[i]] = data[i];
+            }
+            data.resize(n);
+        }
+
+        std::vector<T> data;
+    };
+
+    // outgoing halfedges of v in ccw order
+    template <typename F>
+    void for_each_outgoing(int v, F f) const {
+        int h0 = m_vertex_halfedges[v];
+        if (h0 < 0) return;
+        int h = h0;
+        do {
+            f(h);
+            h = m_prev[h] ^ 1;
+        } while (h != h0);
+    }
+
+    void set_next(int h, int n) {
+        m_next[h] = n;
+        m_prev[n] = h;
+    }
+
+    // returns the halfedge from -> to
+    int new_edge(int from, int to) {
+        int h = (int)m_to_vertex.size();
+        m_to_vertex.push_back(to);
+        m_to_vertex.push_back(from);
+        m_next.resize(h + 2, -1);
+        m_prev.resize(h + 2, -1);
+        m_face.resize(h + 2, -1);
+        m_edge_status.push_back(0);
+        return h;
+    }
+
+    int new_face() {
+        m_face_halfedges.push_back(-1);
+        m_face_normals.emplace_back(0.0f, 0.0f, 0.0f);
+        m_face_status.push_back(0);
+        return (int)m_face_halfedges.size() - 1;
+    }
+
+    // moves the fan of faces starting at the boundary halfedge h to a copy of its vertex
+    int split_fan(int h) {
+        int v = add_vertex(m_points[m_to_vertex[h ^ 1]]).idx();
+        int g = h;
+        while (true) {
+            m_to_vertex[g ^ 1] = v;
+            if (m_face[g ^ 1] < 0) break;
+            g = m_next[g ^ 1];
+        }
+        return v;
+    }
+
+    // boundary vertices keep a boundary halfedge
+    void adjust_outgoing_halfedge(int v) {
+        int boundary = -1;
+        for_each_outgoing(v, [this, &boundary](int h) {
+            if (boundary < 0 && m_face[h] < 0) boundary = h;
+        });
+        if (boundary >= 0) {
+            m_vertex_halfedges[v] = boundary;
+        }
+    }
+
+    // removes a two-sided face left by a collapse, h0 is the halfedge whose edge goes away
+    void collapse_loop(int h0) {
+        int h1 = m_next[h0];
+        int o0 = h0 ^ 1;
+        int o1 = h1 ^ 1;
+        int v0 = m_to_vertex[h0];
+        int v1 = m_to_vertex[h1];
+        int fh = m_face[h0];
+        int fo = m_face[o0];
+
+        set_next(h1, m_next[o0]);
+        set_next(m_prev[o0], h1);
+        m_face[h1] = fo;
+
+        m_vertex_halfedges[v0] = h1;
+        adjust_outgoing_halfedge(v0);
+        m_vertex_halfedges[v1] = o1;
+        adjust_outgoing_halfedge(v1);
+
+        if (fo >= 0 && m_face_halfedges[fo] == o0) m_face_halfedges[fo] = h1;
+        if (fh >= 0) {
+            m_face_halfedges[fh] = -1;
+            m_face_status[fh] |= status_deleted;
+        }
+        // the surviving edge takes the place of the removed one on a crease
+        m_edge_status[h1 >> 1] |= m_edge_status[h0 >> 1] & status_feature;
+        m_edge_status[h0 >> 1] |= status_deleted;
+    }
+
+    // new index of every element, -1 for deleted ones
+    static std::vector<int> compact_map(const std::vector<unsigned char> &status) {
+        std::vector<int> map(status.size(), -1);
+        int n = 0;
+        for (size_t i = 0; i < status.size(); ++i) {
+            if (!(status[i] & status_deleted)) map[i] = n++;
+        }
+        return map;
+    }
+
+    void resize_properties() {
+        for (size_t i = 0; i < m_vertex_properties.size(); ++i) {
+            m_vertex_properties[i]->resize(n_vertices());
+        }
+    }
+
+    std::vector<Point> m_points;
+    std::vector<Normal> m_vertex_normals;
+    std::vector<int> m_vertex_halfedges;
+    std::vector<unsigned char> m_vertex_status;
+
+    std::vector<int> m_to_vertex;
+    std::vector<int> m_next;
+    std::vector<int> m_prev;
+    std::vector<int> m_face;
+
+    std::vector<unsigned char> m_edge_status;
+
+    std::vector<int> m_face_halfedges;
+    std::vector<Normal> m_face_normals;
+    std::vector<unsigned char> m_face_status;
+
+    std::vector<std::unique_ptr<vertex_property_base>> m_vertex_properties;
+};
+
+// copies the live vertices and triangles of an OpenMesh style mesh
+template <typename Mesh>
+bool import_mesh(halfedge_mesh &dst, const Mesh &src) {
+    std::vector<int> vmap(src.n_vertices(), -1);
+    std::vector<halfedge_mesh::Point> points;
+    for (typename Mesh::ConstVertexIter v_it = src.vertices_sbegin(); v_it != src.vertices_end(); ++v_it) {
+        const typename Mesh::Point &p = src.point(*v_it);
+        vmap[v_it->idx()] = (int)points.size();
+        points.emplace_back((float)p[0], (float)p[1], (float)p[2]);
+    }
+    std::vector<int> triangles;
+    for (typename Mesh::ConstFaceIter f_it = src.faces_sbegin(); f_it != src.faces_end(); ++f_it) {
+        for (typename Mesh::ConstFaceVertexIter fv_it = src.cfv_begin(*f_it); fv_it != src.cfv_end(*f_it); ++fv_it) {
+            triangles.push_back(vmap[fv_it->idx()]);
+        }
+    }
+    return dst.build(points, triangles);
+}
+
+// replaces the content of an OpenMesh style mesh with the live vertices and faces of src
+template <typename Mesh>
+void export_mesh(const halfedge_mesh &src, Mesh &dst) {
+    dst.clear();
+    std::vector<typename Mesh::VertexHandle> vmap(src.n_vertices());
+    for (size_t i = 0; i < src.n_vertices(); ++i) {
+        halfedge_mesh::VertexHandle vh((int)i);
+        if (src.status(vh).deleted()) continue;
+        const halfedge_mesh::Point &p = src.point(vh);
+        vmap[i] = dst.add_vertex(typename Mesh::Point(p[0], p[1], p[2]));
+    }
+    for (size_t i = 0; i < src.n_faces(); ++i) {
+        halfedge_mesh::FaceHandle fh((int)i);
+        if (src.status(fh).deleted()) continue;
+        halfedge_mesh::HalfedgeHandle h0 = src.halfedge_handle(fh);
+        halfedge_mesh::HalfedgeHandle h1 = src.next_halfedge_handle(h0);
+        halfedge_mesh::HalfedgeHandle h2 = src.next_halfedge_handle(h1);
+        dst.add_face(vmap[src.to_vertex_handle(h0).idx()], vmap[src.to_vertex_handle(h1).idx()], vmap[src.to_vertex_handle(h2).idx()]);
+    }
+}
@@ -1,7 +1,13 @@
 #pragma once
 
 #include <vector>
+#include <utility>
 #include <Eigen/Eigen>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "RANSAC.h"
 
 /*
 When q = Rp+T maps coordinate from p in camera system 1 to q in camera system 2,
@@ -86,6 +92,57 @@ decompose_homography_continued:
 }
 
 
+/*
+    The homography taking the projective basis e1, e2, e3, (1, 1, 1) to the four points.
+    False if three of the points are (nearly) collinear.
+*/
+inline bool homography_from_basis(const Eigen::Vector2d *p, Eigen::Matrix3d &B) {
+    Eigen::Matrix3d M;
+    M << p[0](0), p[1](0), p[2](0),
+         p[0](1), p[1](1), p[2](1),
+               1,       1,       1;
+    double scale = M.col(0).norm()*M.col(1).norm()*M.col(2).norm();
+    double det = M.determinant();
+    if (!(std::abs(det) > 1e-12*scale)) {
+        return false;
+    }
+    Eigen::Vector3d l = M.inverse()*p[3].homogeneous();
+    double lmax = l.cwiseAbs().maxCoeff();
+    if (!(l.cwiseAbs().minCoeff() > 1e-10*lmax)) {
+        return false;
+    }
+    B = M*l.asDiagonal();
+    return true;
+}
+
+/*
+    Minimal case of solve_homography with exactly four correspondences, pb[i] ~ H*pa[i],
+    through the projective basis of each side. Fixed-size and allocation-free, for RANSAC hypotheses.
+    False if three points of either side are collinear.
+*/
+inline bool solve_homography_4pt(const Eigen::Vector2d *pa, const Eigen::Vector2d *pb, Eigen::Matrix3d &H) {
+    Eigen::Matrix3d Ba, Bb;
+    if (!homography_from_basis(pa, Ba) || !homography_from_basis(pb, Bb)) {
+        return false;
+    }
+    H = Bb*Ba.inverse();
+    H /= H.norm();
+    return H.allFinite();
+}
+
+/*
+    n hypotheses at once, set i uses pa[4*i .. 4*i+3] and pb[4*i .. 4*i+3].
+    Writes H[i] and valid[i], returns the number of valid hypotheses.
+*/
+inline size_t solve_homography_4pt(const Eigen::Vector2d *pa, const Eigen::Vector2d *pb, size_t n, Eigen::Matrix3d *H, unsigned char *valid) {
+    size_t count = 0;
+    for (size_t i = 0; i < n; ++i) {
+        valid[i] = solve_homography_4pt(pa + 4 * i, pb + 4 * i, H[i]) ? 1 : 0;
+        count += valid[i];
+    }
+    return count;
+}
+
 inline bool solve_homography_normalized(const std::vector<Eigen::Vector2d> &pa, const std::vector<Eigen::Vector2d> &pb, Eigen::Matrix3d &H) {
     if (pa.size() < 4 || pa.size() != pb.size()) {
         return false;
@@ -168,3 +225,119 @@ inline bool solve_homography(const std::vector<Eigen::Vector2d> &pa, const std::
 
     return true;
 }
+
+/*
+    Transfer errors |b - H(a)|^2 of n correspondences given as coordinate arrays, written to errors
+    or added to them when accumulate is set. Uses AVX2 for four points at a time when compiled for it.
+    The vector and scalar paths agree up to rounding only, the compiler may fuse the scalar multiply-adds.
+*/
+inline void transfer_errors(const Eigen::Matrix3d &H, const double *ax, const double *ay, const double *bx, const double *by, size_t n, double *errors, bool accumulate = false) {
+    const double h00 = H(0, 0), h01 = H(0, 1), h02 = H(0, 2);
+    const double h10 = H(1, 0), h11 = H(1, 1), h12 = H(1, 2);
+    const double h20 = H(2, 0), h21 = H(2, 1), h22 = H(2, 2);
+    size_t i = 0;
+#ifdef __AVX2__
+    const __m256d m00 = _mm256_set1_pd(h00), m01 = _mm256_set1_pd(h01), m02 = _mm256_set1_pd(h02);
+    const __m256d m10 = _mm256_set1_pd(h10), m11 = _mm256_set1_pd(h11), m12 = _mm256_set1_pd(h12);
+    const __m256d m20 = _mm256_set1_pd(h20), m21 = _mm256_set1_pd(h21), m22 = _mm256_set1_pd(h22);
+    for (; i + 4 <= n; i += 4) {
+        __m256d x = _mm256_loadu_pd(ax + i), y = _mm256_loadu_pd(ay + i);
+        __m256d w = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(m20, x), _mm256_mul_pd(m21, y)), m22);
+        __m256d px = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(m00, x), _mm256_mul_pd(m01, y)), m02);
+        __m256d py = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(m10, x), _mm256_mul_pd(m11, y)), m12);
+        __m256d ex = _mm256_sub_pd(_mm256_div_pd(px, w), _mm256_loadu_pd(bx + i));
+        __m256d ey = _mm256_sub_pd(_mm256_div_pd(py, w), _mm256_loadu_pd(by + i));
+        __m256d e = _mm256_add_pd(_mm256_mul_pd(ex, ex), _mm256_mul_pd(ey, ey));
+        if (accumulate) {
+            e = _mm256_add_pd(e, _mm256_loadu_pd(errors + i));
+        }
+        _mm256_storeu_pd(errors + i, e);
+    }
+#endif
+    for (; i < n; ++i) {
+        double w = h20*ax[i] + h21*ay[i] + h22;
+        double ex = (h00*ax[i] + h01*ay[i] + h02) / w - bx[i];
+        double ey = (h10*ax[i] + h11*ay[i] + h12) / w - by[i];
+        double e = ex*ex + ey*ey;
+        errors[i] = accumulate ? errors[i] + e : e;
+    }
+}
+
+// symmetric transfer errors |b - H(a)|^2 + |a - H^-1(b)|^2, Hinv is the inverse of H
+inline void symmetric_transfer_errors(const Eigen::Matrix3d &H, const Eigen::Matrix3d &Hinv, const double *ax, const double *ay, const double *bx, const double *by, size_t n, double *errors) {
+    transfer_errors(H, ax, ay, bx, by, n, errors);
+    transfer_errors(Hinv, bx, by, ax, ay, n, errors, true);
+}
+
+/*
+    RANSAC model (see RANSAC.h) of pb ~ H*pa for correspondences <pa, pb>.
+    A correspondence is an inlier when its symmetric transfer error
+    |pb - H(pa)|^2 + |pa - H^-1(pb)|^2 is below threshold.
+*/
+struct homography_model {
+    typedef std::pair<Eigen::Vector2d, Eigen::Vector2d> point_type;
+    static const int n_fit = 4;
+
+    Eigen::Matrix3d H = Eigen::Matrix3d::Identity();
+    double threshold;
+
+    homography_model(double threshold = 4.0) : threshold(threshold) {}
+
+    bool fit(const std::vector<point_type> &points, const std::vector<unsigned char> &mask) {
+        pa.clear();
+        pb.clear();
+        for (size_t i = 0; i < points.size(); ++i) {
+            if (mask[i]) {
+                pa.push_back(points[i].first);
+                pb.push_back(points[i].second);
+            }
+        }
+        // minimal samples take the fixed-size solver
+        bool solved = pa.size() == n_fit ? solve_homography_4pt(pa.data(), pb.data(), H) : solve_homography(pa, pb, H);
+        if (!solved) {
+            return false;
+        }
+        double det = H.determinant();
+        if (!std::isfinite(det) || std::abs(det) < 1e-12) {
+            return false;
+        }
+        Hinv = H.inverse();
+        return true;
+    }
+
+    double error(const point_type &point) const {
+        Eigen::Vector3d qb = H*point.first.homogeneous();
+        Eigen::Vector3d qa = Hinv*point.second.homogeneous();
+        return (point.second - qb.hnormalized()).squaredNorm() + (point.first - qa.hnormalized()).squaredNorm();
+    }
+
+    bool consensus(const point_type &point) {
+        return error(point) < threshold;
+    }
+
+    void consensus_batch(const point_type *points, size_t n, unsigned char *mask) {
+        double errors[256];
+        for (size_t first = 0; first < n; first += 256) {
+            size_t m = std::min(n - first, size_t(256));
+            error_batch(points + first, m, errors);
+            for (size_t i = 0; i < m; ++i) {
+                mask[first + i] = errors[i] < threshold ? 1 : 0;
+            }
+        }
+    }
+
+    void error_batch(const point_type *points, size_t n, double *errors) {
+        ransac_soa_block<double, 4> block;
+        for (size_t first = 0; first < n; first += block.capacity) {
+            block.load(points + first, n - first, [](const point_type &p, double *v) {
+                v[0] = p.first.x(); v[1] = p.first.y(); v[2] = p.second.x(); v[3] = p.second.y();
+            });
+            symmetric_transfer_errors(H, Hinv, block[0], block[1], block[2], block[3], block.size, errors + first);
+        }
+    }
+
+private:
+    Eigen::Matrix3d Hinv = Eigen::Matrix3d::Identity();
+    std::vector<Eigen::Vector2d> pa;
+    std::vector<Eigen::Vector2d> pb;
+};
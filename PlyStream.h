@@ -0,0 +1,301 @@
+#pragma once
+
+/*
+    Streaming PLY reader and writer for triangle meshes.
+    The reader parses ascii and binary files row by row, vertices first, then faces.
+    The writer produces binary little endian files of unknown size: vertices and faces
+    go to two side files which are joined under the header on close().
+*/
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <algorithm>
+
+class ply_reader {
+public:
+    ply_reader() {}
+
+    bool open(const std::string &path) {
+        m_file.open(path, std::ios::binary);
+        if (!m_file) return false;
+        m_elements.clear();
+        m_current = 0;
+        m_row = 0;
+
+        std::string line;
+        std::getline(m_file, line);
+        if (trim(line) != "ply") return false;
+        while (std::getline(m_file, line)) {
+            std::istringstream words(trim(line));
+            std::string word;
+            words >> word;
+            if (word == "format") {
+                std::string format;
+                words >> format;
+                if (format == "ascii") m_format = ascii;
+                else if (format == "binary_little_endian") m_format = binary_little_endian;
+                else if (format == "binary_big_endian") m_format = binary_big_endian;
+                else return false;
+            }
+            else if (word == "element") {
+                element e;
+                words >> e.name >> e.count;
+                m_elements.push_back(e);
+            }
+            else if (word == "property") {
+                if (m_elements.empty()) return false;
+                property p;
+                std::string type;
+                words >> type;
+                if (type == "list") {
+                    std::string count_type;
+                    words >> count_type >> type;
+                    p.count_type = parse_type(count_type);
+                    if (p.count_type == type_invalid) return false;
+                }
+                p.type = parse_type(type);
+                if (p.type == type_invalid) return false;
+                words >> p.name;
+                m_elements.back().properties.push_back(p);
+            }
+            else if (word == "end_header") {
+                break;
+            }
+        }
+        return (bool)m_file && find_element("vertex") >= 0 && find_element("face") >= 0;
+    }
+
+    size_t vertex_count() const {
+        return m_elements[find_element("vertex")].count;
+    }
+
+    size_t face_count() const {
+        return m_elements[find_element("face")].count;
+    }
+
+    // reads the next vertex position, false after the last vertex
+    bool read_vertex(float p[3]) {
+        if (!seek_element("vertex")) return false;
+        const element &e = m_elements[m_current];
+        for (size_t i = 0; i < e.properties.size(); ++i) {
+            read_property(e.properties[i]);
+            const std::string &name = e.properties[i].name;
+            if (name.size() == 1 && name[0] >= 'x' && name[0] <= 'z') {
+                p[name[0] - 'x'] = (float)m_values[0];
+            }
+        }
+        m_row++;
+        return (bool)m_file;
+    }
+
+    // reads the vertex indices of the next face, false after the last face
+    bool read_face(std::vector<int> &indices) {
+        if (!seek_element("face")) return false;
+        const element &e = m_elements[m_current];
+        indices.clear();
+        for (size_t i = 0; i < e.properties.size(); ++i) {
+            read_property(e.properties[i]);
+            if (e.properties[i].name == "vertex_indices" || e.properties[i].name == "vertex_index") {
+                for (size_t k = 0; k < m_values.size(); ++k) {
+                    indices.push_back((int)m_values[k]);
+                }
+            }
+        }
+        m_row++;
+        return (bool)m_file;
+    }
+
+private:
+    enum format_type { ascii, binary_little_endian, binary_big_endian };
+    enum value_type { type_invalid, type_int8, type_uint8, type_int16, type_uint16, type_int32, type_uint32, type_float32, type_float64 };
+
+    struct property {
+        std::string name;
+        value_type type = type_invalid;
+        value_type count_type = type_invalid;   // valid for lists only
+    };
+
+    struct element {
+        std::string name;
+        size_t count = 0;
+        std::vector<property> properties;
+    };
+
+    static std::string trim(const std::string &s) {
+        size_t end = s.find_last_not_of(" \t\r\n");
+        return end == std::string::npos ? std::string() : s.substr(0, end + 1);
+    }
+
+    static value_type parse_type(const std::string &type) {
+        if (type == "char" || type == "int8") return type_int8;
+        if (type == "uchar" || type == "uint8") return type_uint8;
+        if (type == "short" || type == "int16") return type_int16;
+        if (type == "ushort" || type == "uint16") return type_uint16;
+        if (type == "int" || type == "int32") return type_int32;
+        if (type == "uint" || type == "uint32") return type_uint32;
+        if (type == "float" || type == "float32") return type_float32;
+        if (type == "double" || type == "float64") return type_float64;
+        return type_invalid;
+    }
+
+    int find_element(const std::string &name) const {
+        for (size_t i = 0; i < m_elements.size(); ++i) {
+            if (m_elements[i].name == name) return (int)i;
+        }
+        return -1;
+    }
+
+    // skips the rows up to the named element, false once it is exhausted
+    bool seek_element(const std::string &name) {
+        while (m_current < m_elements.size()) {
+            const element &e = m_elements[m_current];
+            if (m_row < e.count) {
+                if (e.name == name) return true;
+                for (size_t i = 0; i < e.properties.size(); ++i) {
+                    read_property(e.properties[i]);
+                }
+                m_row++;
+            }
+            else {
+                if (e.name == name) return false;
+                m_current++;
+                m_row = 0;
+            }
+        }
+        return false;
+    }
+
+    // reads one scalar or list into m_values
+    void read_property(const property &p) {
+        m_values.clear();
+        if (p.count_type != type_invalid) {
+            size_t count = (size_t)read_value(p.count_type);
+            for (size_t k = 0; k < count; ++k) {
+                m_values.push_back(read_value(p.type));
+            }
+        }
+        else {
+            m_values.push_back(read_value(p.type));
+        }
+    }
+
+    double read_value(value_type type) {
+        if (m_format == ascii) {
+            double v = 0.0;
+            m_file >> v;
+            return v;
+        }
+        switch (type) {
+        case type_int8: return read_binary<std::int8_t>();
+        case type_uint8: return read_binary<std::uint8_t>();
+        case type_int16: return read_binary<std::int16_t>();
+        case type_uint16: return read_binary<std::uint16_t>();
+        case type_int32: return read_binary<std::int32_t>();
+        case type_uint32: return read_binary<std::uint32_t>();
+        case type_float32: return read_binary<float>();
+        case type_float64: return read_binary<double>();
+        default: return 0.0;
+        }
+    }
+
+    // assumes a little endian host
+    template <typename T>
+    T read_binary() {
+        char bytes[sizeof(T)];
+        m_file.read(bytes, sizeof(T));
+        if (m_format == binary_big_endian) {
+            for (size_t i = 0; i < sizeof(T) / 2; ++i) {
+                std::swap(bytes[i], bytes[sizeof(T) - 1 - i]);
+            }
+        }
+        T v;
+        memcpy(&v, bytes, sizeof(T));
+        return v;
+    }
+
+    std::ifstream m_file;
+    format_type m_format = ascii;
+    std::vector<element> m_elements;
+    size_t m_current = 0;
+    size_t m_row = 0;
+    std::vector<double> m_values;
+};
+
+class ply_writer {
+public:
+    ply_writer() {}
+
+    ~ply_writer() {
+        close();
+    }
+
+    bool open(const std::string &path) {
+        m_path = path;
+        m_n_vertices = 0;
+        m_n_faces = 0;
+        m_vertices.open(path + ".vertices", std::ios::binary);
+        m_faces.open(path + ".faces", std::ios::binary);
+        return m_vertices && m_faces;
+    }
+
+    // returns the index of the written vertex
+    std::uint32_t write_vertex(const float p[3]) {
+        m_vertices.write((const char *)p, 3 * sizeof(float));
+        return m_n_vertices++;
+    }
+
+    void write_face(std::uint32_t a, std::uint32_t b, std::uint32_t c) {
+        const std::uint8_t n = 3;
+        const std::uint32_t indices[3] = { a, b, c };
+        m_faces.write((const char *)&n, 1);
+        m_faces.write((const char *)indices, sizeof(indices));
+        m_n_faces++;
+    }
+
+    size_t vertex_count() const {
+        return m_n_vertices;
+    }
+
+    size_t face_count() const {
+        return m_n_faces;
+    }
+
+    bool close() {
+        if (m_path.empty()) return true;
+        m_vertices.close();
+        m_faces.close();
+        std::ofstream file(m_path, std::ios::binary);
+        file << "ply\nformat binary_little_endian 1.0\n"
+             << "element vertex " << m_n_vertices << "\n"
+             << "property float x\nproperty float y\nproperty float z\n"
+             << "element face " << m_n_faces << "\n"
+             << "property list uchar uint vertex_indices\n"
+             << "end_header\n";
+        bool ok = append(file, m_path + ".vertices") && append(file, m_path + ".faces");
+        std::remove((m_path + ".vertices").c_str());
+        std::remove((m_path + ".faces").c_str());
+        m_path.clear();
+        return ok && (bool)file;
+    }
+
+private:
+    static bool append(std::ofstream &file, const std::string &path) {
+        std::ifstream part(path, std::ios::binary);
+        if (!part) return false;
+        if (part.peek() != std::ifstream::traits_type::eof()) {
+            file << part.rdbuf();
+        }
+        return true;
+    }
+
+    std::string m_path;
+    std::ofstream m_vertices;
+    std::ofstream m_faces;
+    std::uint32_t m_n_vertices = 0;
+    size_t m_n_faces = 0;
+};
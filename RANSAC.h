@@ -1,8 +1,15 @@
 #pragma once
 
+#include <mutex>
+#include <atomic>
+#include <limits>
 #include <vector>
+#include <utility>
+#include <algorithm>
+#include <type_traits>
 
 #include "Random.h"
+#include "parallel_for.h"
 
 /*
 struct Model {
@@ -10,49 +17,549 @@ struct Model {
     static const int n_fit;
     bool fit(const std::vector<point_type> &all_points, const std::vector<unsigned char> &sampling_mask);
     bool consensus(const point_type &point);
+    // optional, used instead of consensus() when present: mask[i] = consensus(points[i])
+    void consensus_batch(const point_type *points, size_t n, unsigned char *mask);
+    // optional, for ransac_options::max_error, and its batch version
+    double error(const point_type &point);
+    void error_batch(const point_type *points, size_t n, double *errors);
 };
+
+struct Sampler {
+    void reset(size_t n_points);                // called once before the first sample
+    bool sample(size_t *indices, int n);        // n distinct indices, false if none can be drawn
+    int iterations(const std::vector<unsigned char> &inliers, double success_rate, int n, int max_iter);    // bound after a new best
+    void seed(std::uint64_t value, std::uint64_t stream);
+};
+*/
+
+// iterations to draw an all-inlier sample with probability success_rate
+inline int ransac_iterations(double success_rate, double inlier_rate, int n_fit, int max_iter) {
+    double n = ceil(log(1 - success_rate) / log(1 - pow(inlier_rate, n_fit)));
+    return n < max_iter ? (int)n : max_iter;
+}
+
+// n distinct indices in [0, range), by rejection since n is the few points of a minimal sample
+inline void ransac_draw_distinct(UniformInteger<size_t> &rnd, size_t range, size_t *indices, int n) {
+    for (int i = 0; i < n; ++i) {
+        bool fresh;
+        do {
+            indices[i] = rnd.next(0, range - 1);
+            fresh = true;
+            for (int j = 0; j < i; ++j) {
+                fresh = fresh && indices[j] != indices[i];
+            }
+        } while (!fresh);
+    }
+}
+
+// uniform minimal samples, without replacement
+class ransac_uniform_sampler {
+public:
+    void reset(size_t n_points) {
+        this->n_points = n_points;
+    }
+
+    bool sample(size_t *indices, int n) {
+        if (n_points < (size_t)n) {
+            return false;
+        }
+        ransac_draw_distinct(rnd, n_points, indices, n);
+        return true;
+    }
+
+    int iterations(const std::vector<unsigned char> &inliers, double success_rate, int n, int max_iter) const {
+        size_t count = std::count(inliers.begin(), inliers.end(), 1);
+        return ransac_iterations(success_rate, double(count) / double(inliers.size()), n, max_iter);
+    }
+
+    void seed(std::uint64_t value, std::uint64_t stream) {
+        rnd.seed(value, stream);
+    }
+
+private:
+    size_t n_points = 0;
+    UniformInteger<size_t> rnd;
+};
+
+/*
+    Matching with PROSAC - progressive sample consensus, O. Chum, J. Matas, CVPR 2005.
+    Points must be ordered by decreasing quality (e.g. matching score). Samples are first
+    drawn from the best few points and the pool grows towards all points, so good
+    correspondences are tried early and the uniform case is reached after max_samples draws.
+*/
+class ransac_prosac_sampler {
+public:
+    ransac_prosac_sampler(double max_samples = 200000, double beta = 0.05) : max_samples(max_samples), beta(beta) {}
+
+    void reset(size_t n_points) {
+        this->n_points = n_points;
+        m = 0;
+    }
+
+    bool sample(size_t *indices, int n) {
+        if (n_points < (size_t)n) {
+            return false;
+        }
+        if (m != n) {
+            start(n);
+        }
+
+        t++;
+        if (t >= tp && pool < n_points) {
+            double next_tn = tn * double(pool + 1) / double(pool + 1 - m);
+            tp += (size_t)ceil(next_tn - tn);
+            tn = next_tn;
+            pool++;
+        }
+
+        if (tp < t) {
+            ransac_draw_distinct(rnd, pool, indices, n);
+        }
+        else {
+            // the newest point of the pool with m - 1 from the older ones
+            ransac_draw_distinct(rnd, pool - 1, indices, n - 1);
+            indices[n - 1] = pool - 1;
+        }
+        return true;
+    }
+
+    /*
+        The bound of the best prefix of the quality order: the fewest iterations over all
+        pools whose inlier count is unlikely to come from a wrong model (non-randomness test
+        with outlier consistency beta, by the normal approximation at the 1% level).
+    */
+    int iterations(const std::vector<unsigned char> &inliers, double success_rate, int n, int max_iter) const {
+        int best = max_iter;
+        size_t count = 0;
+        for (size_t k = 0; k < inliers.size(); ++k) {
+            count += inliers[k] ? 1 : 0;
+            size_t pool = k + 1;
+            if (pool < (size_t)n) {
+                continue;
+            }
+            double spread = double(pool - n);
+            double random_count = n + beta*spread + 2.33*sqrt(beta*(1 - beta)*spread);
+            if (count >= random_count || pool == inliers.size()) {
+                best = std::min(best, ransac_iterations(success_rate, double(count) / double(pool), n, max_iter));
+            }
+        }
+        return best;
+    }
+
+    void seed(std::uint64_t value, std::uint64_t stream) {
+        rnd.seed(value, stream);
+    }
+
+private:
+    void start(int n) {
+        m = n;
+        pool = m;
+        t = 0;
+        tp = 1;
+        // average number of samples from the first m points among max_samples uniform ones
+        tn = max_samples;
+        for (int i = 0; i < m; ++i) {
+            tn *= double(m - i) / double(n_points - i);
+        }
+    }
+
+    double max_samples;
+    double beta;
+    size_t n_points = 0;
+    int m = 0;
+    size_t pool = 0;
+    size_t t = 0;
+    size_t tp = 0;
+    double tn = 0.0;
+    UniformInteger<size_t> rnd;
+};
+
+/*
+    NAPSAC: High Noise, High Dimensional Robust Estimation - it's in the Bag, D. R. Myatt et al., BMVC 2002.
+    A sample is a random point with n - 1 of its spatial neighbors, neighbors[i] lists those of point i
+    (e.g. from KnnIndex). A list may contain point i itself, it is skipped when drawing.
+    Points with too few other neighbors get a uniform sample instead.
 */
+class ransac_napsac_sampler {
+public:
+    ransac_napsac_sampler(const std::vector<std::vector<size_t>> &neighbors) : neighbors(neighbors) {}
+
+    void reset(size_t n_points) {
+        this->n_points = n_points;
+    }
+
+    bool sample(size_t *indices, int n) {
+        if (n_points < (size_t)n) {
+            return false;
+        }
+        size_t center = rnd.next(0, n_points - 1);
+        const std::vector<size_t> &near = neighbors[center];
+        // draw from the other neighbors, indices past center's own entry shift by one
+        size_t self = std::find(near.begin(), near.end(), center) - near.begin();
+        size_t others = near.size() - (self < near.size() ? 1 : 0);
+        if (others + 1 < (size_t)n) {
+            ransac_draw_distinct(rnd, n_points, indices, n);
+            return true;
+        }
+        ransac_draw_distinct(rnd, others, indices, n - 1);
+        for (int i = 0; i < n - 1; ++i) {
+            indices[i] = near[indices[i] < self ? indices[i] : indices[i] + 1];
+        }
+        indices[n - 1] = center;
+        return true;
+    }
+
+    int iterations(const std::vector<unsigned char> &inliers, double success_rate, int n, int max_iter) const {
+        size_t count = std::count(inliers.begin(), inliers.end(), 1);
+        return ransac_iterations(success_rate, double(count) / double(inliers.size()), n, max_iter);
+    }
+
+    void seed(std::uint64_t value, std::uint64_t stream) {
+        rnd.seed(value, stream);
+    }
+
+private:
+    const std::vector<std::vector<size_t>> &neighbors;
+    size_t n_points = 0;
+    UniformInteger<size_t> rnd;
+};
+
+struct ransac_options {
+    double success_rate = 0.95;
+    int max_iter = 20000000;
+    // LO-RANSAC refits of each new best model, 0 disables
+    int local_iterations = 4;
+    // > 0 scores hypotheses by ransac_robust_loss() of Model::error() instead of counting inliers
+    double max_error = 0.0;
+};
+
+template <typename Model, typename = void>
+struct ransac_has_consensus_batch : std::false_type {};
 
 template <typename Model>
-inline void ransac(Model &model, const std::vector<typename Model::point_type> &points, std::vector<unsigned char>& inliers, double success_rate = 0.95, int max_iter = 20000000) {
-    UniformInteger<size_t> rnd(0, points.size() - 1);
+struct ransac_has_consensus_batch<Model, decltype(std::declval<Model &>().consensus_batch(std::declval<const typename Model::point_type *>(), size_t(0), std::declval<unsigned char *>()))> : std::true_type {};
+
+template <typename Model, typename = void>
+struct ransac_has_error : std::false_type {};
+
+template <typename Model>
+struct ransac_has_error<Model, decltype(void(std::declval<Model &>().error(std::declval<const typename Model::point_type &>())))> : std::true_type {};
 
+template <typename Model, typename = void>
+struct ransac_has_error_batch : std::false_type {};
+
+template <typename Model>
+struct ransac_has_error_batch<Model, decltype(std::declval<Model &>().error_batch(std::declval<const typename Model::point_type *>(), size_t(0), std::declval<double *>()))> : std::true_type {};
+
+/*
+    Components of up to Capacity points in structure of arrays layout, so batch kernels
+    run over contiguous arrays. get(point, values) writes the Components values of a point.
+*/
+template <typename T, size_t Components, size_t Capacity = 256>
+struct ransac_soa_block {
+    static const size_t capacity = Capacity;
+
+    T data[Components][Capacity];
+    size_t size = 0;
+
+    template <typename Point, typename F>
+    void load(const Point *points, size_t n, F get) {
+        size = std::min(n, Capacity);
+        T values[Components];
+        for (size_t i = 0; i < size; ++i) {
+            get(points[i], values);
+            for (size_t k = 0; k < Components; ++k) {
+                data[k][i] = values[k];
+            }
+        }
+    }
+
+    const T *operator[](size_t k) const {
+        return data[k];
+    }
+};
+
+template <typename Model>
+inline void ransac_errors(Model &model, const typename Model::point_type *points, size_t n, double *errors, std::true_type) {
+    model.error_batch(points, n, errors);
+}
+
+template <typename Model>
+inline void ransac_errors(Model &model, const typename Model::point_type *points, size_t n, double *errors, std::false_type) {
+    for (size_t i = 0; i < n; ++i) {
+        errors[i] = model.error(points[i]);
+    }
+}
+
+/*
+    Marks the inliers of the current model in mask and returns their count.
+    Counting stops once the hypothesis cannot beat best_count, the result is then at most best_count.
+    The indices set in mask are appended to marked, if given.
+*/
+template <typename Model>
+inline size_t ransac_consensus(Model &model, const std::vector<typename Model::point_type> &points, std::vector<unsigned char> &mask, size_t best_count, std::vector<size_t> *marked, std::false_type) {
+    size_t inlier_count = 0;
+    for (size_t i = 0; i < points.size(); ++i) {
+        if (inlier_count + (points.size() - i) <= best_count) {
+            break;
+        }
+        if (model.consensus(points[i])) {
+            mask[i] = 1;
+            inlier_count++;
+            if (marked) {
+                marked->push_back(i);
+            }
+        }
+    }
+    return inlier_count;
+}
+
+// blocks through consensus_batch(), with the early exit checked between blocks
+template <typename Model>
+inline size_t ransac_consensus(Model &model, const std::vector<typename Model::point_type> &points, std::vector<unsigned char> &mask, size_t best_count, std::vector<size_t> *marked, std::true_type) {
+    const size_t block = 256;
+    unsigned char batch[block];
+    size_t inlier_count = 0;
+    for (size_t i = 0; i < points.size(); i += block) {
+        if (inlier_count + (points.size() - i) <= best_count) {
+            break;
+        }
+        size_t n = std::min(block, points.size() - i);
+        model.consensus_batch(&points[i], n, batch);
+        for (size_t k = 0; k < n; ++k) {
+            if (batch[k]) {
+                mask[i + k] = 1;
+                inlier_count++;
+                if (marked) {
+                    marked->push_back(i + k);
+                }
+            }
+        }
+    }
+    return inlier_count;
+}
+
+template <typename Model>
+inline size_t ransac_consensus(Model &model, const std::vector<typename Model::point_type> &points, std::vector<unsigned char> &mask, size_t best_count, std::vector<size_t> *marked) {
+    return ransac_consensus(model, points, mask, best_count, marked, ransac_has_consensus_batch<Model>());
+}
+
+template <typename Model>
+inline size_t ransac_consensus(Model &model, const std::vector<typename Model::point_type> &points, std::vector<unsigned char> &mask, size_t best_count = 0) {
+    return ransac_consensus(model, points, mask, best_count, nullptr);
+}
+
+/*
+    The truncated quadratic loss min(e/t, 1) of a squared error e, averaged over all thresholds t
+    in (0, max_error]: (e/max_error)*(1 + log(max_error/e)) below max_error and 1 above.
+    Like MAGSAC++ it marginalizes the threshold instead of fixing it, so the score is smooth
+    and hardly depends on max_error, as long as it is not too tight.
+*/
+inline double ransac_robust_loss(double e, double max_error) {
+    if (e >= max_error) {
+        return 1.0;
+    }
+    if (e <= 0.0) {
+        return 0.0;
+    }
+    double r = e / max_error;
+    return r*(1.0 - log(r));
+}
+
+template <typename Model>
+inline double ransac_robust_score(Model &model, const std::vector<typename Model::point_type> &points, std::vector<unsigned char> &mask, double best, double max_error, std::vector<size_t> *marked, std::true_type) {
+    const size_t block = 256;
+    double errors[block];
+    double score = 0.0;
+    for (size_t i = 0; i < points.size() && score < best; i += block) {
+        size_t n = std::min(block, points.size() - i);
+        ransac_errors(model, &points[i], n, errors, ransac_has_error_batch<Model>());
+        for (size_t k = 0; k < n; ++k) {
+            score += ransac_robust_loss(errors[k], max_error);
+            if (errors[k] < max_error) {
+                mask[i + k] = 1;
+                if (marked) {
+                    marked->push_back(i + k);
+                }
+            }
+        }
+    }
+    return score;
+}
+
+// a model without error() is scored by counting
+template <typename Model>
+inline double ransac_robust_score(Model &model, const std::vector<typename Model::point_type> &points, std::vector<unsigned char> &mask, double best, double, std::vector<size_t> *marked, std::false_type) {
+    size_t best_count = best < double(points.size()) ? points.size() - (size_t)best : 0;
+    return double(points.size() - ransac_consensus(model, points, mask, best_count, marked));
+}
+
+/*
+    Scores the current model and marks its inliers in mask, lower is better.
+    Counts the outliers, or with options.max_error > 0 and a Model::error(), sums the loss of
+    ransac_robust_loss(). Stops once the hypothesis cannot beat best, the result is then at least best.
+    Only entries set to 1 are written to mask, their indices are appended to marked, if given.
+*/
+template <typename Model>
+inline double ransac_score(Model &model, const std::vector<typename Model::point_type> &points, std::vector<unsigned char> &mask, double best, const ransac_options &options, std::vector<size_t> *marked) {
+    if (options.max_error > 0) {
+        return ransac_robust_score(model, points, mask, best, options.max_error, marked, ransac_has_error<Model>());
+    }
+    size_t best_count = best < double(points.size()) ? points.size() - (size_t)best : 0;
+    return double(points.size() - ransac_consensus(model, points, mask, best_count, marked));
+}
+
+template <typename Model>
+inline double ransac_score(Model &model, const std::vector<typename Model::point_type> &points, std::vector<unsigned char> &mask, double best, const ransac_options &options) {
+    return ransac_score(model, points, mask, best, options, nullptr);
+}
+
+/*
+    LO-RANSAC: Locally Optimized RANSAC, O. Chum, J. Matas, J. Kittler, DAGM 2003.
+    Refits on the inliers of a new best model as long as that improves its score,
+    scratch is a mask of the same size. A refit that does not improve is dropped, so model
+    and inliers always agree. Returns the final score.
+*/
+template <typename Model>
+inline double ransac_local_optimize(Model &model, const std::vector<typename Model::point_type> &points, std::vector<unsigned char> &inliers, std::vector<unsigned char> &scratch, double score, const ransac_options &options) {
+    if (options.local_iterations <= 0) {
+        return score;
+    }
+    Model refit = model;
+    for (int k = 0; k < options.local_iterations; ++k) {
+        if (!refit.fit(points, inliers)) {
+            break;
+        }
+        std::fill(scratch.begin(), scratch.end(), 0);
+        double refined = ransac_score(refit, points, scratch, score, options);
+        if (refined >= score) {
+            break;
+        }
+        score = refined;
+        inliers.swap(scratch);
+        model = refit;
+    }
+    return score;
+}
+
+/*
+    Final fit on all inliers of the best model, kept only if it does not score worse,
+    otherwise model and inliers stay as they are.
+*/
+template <typename Model>
+inline void ransac_final_fit(Model &model, const std::vector<typename Model::point_type> &points, std::vector<unsigned char> &inliers, std::vector<unsigned char> &scratch, double score, const ransac_options &options) {
+    Model refit = model;
+    if (!refit.fit(points, inliers)) {
+        return;
+    }
+    scratch.assign(points.size(), 0);
+    double refined = ransac_score(refit, points, scratch, std::numeric_limits<double>::max(), options);
+    if (refined <= score) {
+        model = refit;
+        inliers.swap(scratch);
+    }
+}
+
+/*
+    Workspace of ransac() kept across calls: the sampler with its random state and the masks.
+    Between calls the mask is all zero. Scoring records the indices it sets, so a hypothesis that
+    does not improve the best model zeroes only its sample and its inliers, only a new best clears
+    the whole mask.
+    Each call still resets the caller's inliers, and a new best model swaps that buffer
+    with the context's mask, so the two vectors trade storage across calls.
+*/
+template <typename Sampler = ransac_uniform_sampler>
+class ransac_context {
+public:
+    ransac_context(const Sampler &sampler = Sampler()) : sampler(sampler) {}
+
+    Sampler &get_sampler() {
+        return sampler;
+    }
+
+private:
+    template <typename Model, typename S>
+    friend void ransac(Model &model, const std::vector<typename Model::point_type> &points, std::vector<unsigned char> &inliers, ransac_context<S> &context, const ransac_options &options);
+
+    Sampler sampler;
+    std::vector<unsigned char> mask;
+    std::vector<unsigned char> scratch;
+    std::vector<size_t> marked;
+};
+
+template <typename Model, typename Sampler>
+inline void ransac(Model &model, const std::vector<typename Model::point_type> &points, std::vector<unsigned char>& inliers, ransac_context<Sampler> &context, const ransac_options &options) {
     int n_iter = 0;
+    int max_iter = options.max_iter;
 
-    double best_inlier_rate = 0.0;
-    std::vector<unsigned char> inlier_set(points.size(), 0);
-    inliers.resize(points.size());
+    double best_score = std::numeric_limits<double>::max();
+    Model best_model = model;
+    std::vector<unsigned char> &inlier_set = context.mask;
+    inlier_set.resize(points.size(), 0);
+    context.scratch.resize(points.size());
+    std::vector<size_t> &marked = context.marked;
+    marked.clear();
+    inliers.assign(points.size(), 0);
+    Sampler &sampler = context.sampler;
+    sampler.reset(points.size());
+    size_t sample[Model::n_fit];
 
     while (n_iter < max_iter) {
-        // sample
+        if (!sampler.sample(sample, Model::n_fit)) {
+            break;
+        }
         for (int i = 0; i < Model::n_fit; ++i) {
-            inlier_set[rnd.next()] = 1;
+            inlier_set[sample[i]] = 1;
         }
 
         if (model.fit(points, inlier_set)) {
-            size_t inlier_count = 0;
-            for (size_t i = 0; i < points.size(); ++i) {
-                if (model.consensus(points[i])) {
-                    inlier_set[i] = 1;
-                    inlier_count++;
-                }
-            }
+            double score = ransac_score(model, points, inlier_set, best_score, options, &marked);
 
-            double inlier_rate = double(inlier_count) / double(points.size());
-
-            if (inlier_rate > best_inlier_rate) {
-                best_inlier_rate = inlier_rate;
+            if (score < best_score) {
                 inliers.swap(inlier_set);
-                int new_max_iter = (int)ceil(log(1 - success_rate) / log(1 - pow(best_inlier_rate, Model::n_fit)));
-                max_iter = std::min(max_iter, new_max_iter);
+                best_score = ransac_local_optimize(model, points, inliers, context.scratch, score, options);
+                best_model = model;
+                max_iter = sampler.iterations(inliers, options.success_rate, Model::n_fit, max_iter);
+                // the mask now holds the previous best
+                std::fill(inlier_set.begin(), inlier_set.end(), 0);
+                marked.clear();
             }
         }
 
-        std::fill(inlier_set.begin(), inlier_set.end(), 0);
+        for (size_t i = 0; i < marked.size(); ++i) {
+            inlier_set[marked[i]] = 0;
+        }
+        marked.clear();
+        for (int i = 0; i < Model::n_fit; ++i) {
+            inlier_set[sample[i]] = 0;
+        }
         n_iter++;
     }
 
-    model.fit(points, inliers);
+    // model holds the last hypothesis, the best one was kept aside
+    model = best_model;
+    if (best_score < std::numeric_limits<double>::max()) {
+        ransac_final_fit(model, points, inliers, context.scratch, best_score, options);
+    }
+}
+
+template <typename Model, typename Sampler, typename = typename std::enable_if<!std::is_arithmetic<Sampler>::value>::type>
+inline void ransac(Model &model, const std::vector<typename Model::point_type> &points, std::vector<unsigned char>& inliers, Sampler sampler, const ransac_options &options) {
+    ransac_context<Sampler> context(sampler);
+    ransac(model, points, inliers, context, options);
+}
+
+template <typename Model, typename Sampler, typename = typename std::enable_if<!std::is_arithmetic<Sampler>::value>::type>
+inline void ransac(Model &model, const std::vector<typename Model::point_type> &points, std::vector<unsigned char>& inliers, Sampler sampler, double success_rate = 0.95, int max_iter = 20000000) {
+    ransac_options options;
+    options.success_rate = success_rate;
+    options.max_iter = max_iter;
+    ransac(model, points, inliers, sampler, options);
+}
+
+template <typename Model>
+inline void ransac(Model &model, const std::vector<typename Model::point_type> &points, std::vector<unsigned char>& inliers, double success_rate = 0.95, int max_iter = 20000000) {
+    ransac(model, points, inliers, ransac_uniform_sampler(), success_rate, max_iter);
 }
 
 template <typename Model>
@@ -60,3 +567,124 @@ inline void ransac(Model &model, const std::vector<typename Model::point_type> &
     std::vector<unsigned char> inliers;
     ransac(model, points, inliers, success_rate, max_iter);
 }
+
+/*
+    ransac() with hypotheses spread over n_threads threads (0 for one per core),
+    exactly n_threads threads run even when that exceeds the number of cores.
+    Each thread fits and scores its own copy of model and draws from its own copy of sampler,
+    so both must be copyable.
+    The iteration budget and the best score are shared, so every thread
+    stops as soon as the adaptive bound is reached and skips hypotheses that cannot win.
+    Local optimization runs on the finding thread before the best is replaced.
+*/
+template <typename Model, typename Sampler, typename = typename std::enable_if<!std::is_arithmetic<Sampler>::value>::type>
+inline void ransac_parallel(Model &model, const std::vector<typename Model::point_type> &points, std::vector<unsigned char>& inliers, const Sampler &sampler, const ransac_options &options, size_t n_threads = 0) {
+    if (n_threads == 0) {
+        n_threads = parallel_thread_count();
+    }
+
+    std::atomic<int> n_iter(0);
+    std::atomic<int> shared_max_iter(options.max_iter);
+    std::atomic<double> best_score(std::numeric_limits<double>::max());
+    std::mutex best_mutex;
+    Model best_model = model;
+    inliers.assign(points.size(), 0);
+
+    const unsigned int seed = get_random_seed();
+    parallel_threads(n_threads, [&](size_t thread) {
+        Model local = model;
+        Sampler local_sampler = sampler;
+        local_sampler.seed(seed, thread);
+        local_sampler.reset(points.size());
+        size_t sample[Model::n_fit];
+        std::vector<unsigned char> inlier_set(points.size(), 0);
+        std::vector<unsigned char> scratch(points.size(), 0);
+
+        while (n_iter++ < shared_max_iter) {
+            if (!local_sampler.sample(sample, Model::n_fit)) {
+                break;
+            }
+            for (int i = 0; i < Model::n_fit; ++i) {
+                inlier_set[sample[i]] = 1;
+            }
+
+            if (local.fit(points, inlier_set)) {
+                double score = ransac_score(local, points, inlier_set, best_score, options);
+
+                if (score < best_score) {
+                    score = ransac_local_optimize(local, points, inlier_set, scratch, score, options);
+                    std::lock_guard<std::mutex> lock(best_mutex);
+                    if (score < best_score) {
+                        best_score = score;
+                        best_model = local;
+                        inliers.swap(inlier_set);
+                        shared_max_iter = local_sampler.iterations(inliers, options.success_rate, Model::n_fit, shared_max_iter);
+                    }
+                }
+            }
+
+            std::fill(inlier_set.begin(), inlier_set.end(), 0);
+        }
+    });
+
+    model = best_model;
+    if (best_score < std::numeric_limits<double>::max()) {
+        std::vector<unsigned char> scratch;
+        ransac_final_fit(model, points, inliers, scratch, best_score, options);
+    }
+}
+
+template <typename Model, typename Sampler, typename = typename std::enable_if<!std::is_arithmetic<Sampler>::value>::type>
+inline void ransac_parallel(Model &model, const std::vector<typename Model::point_type> &points, std::vector<unsigned char>& inliers, const Sampler &sampler, double success_rate = 0.95, int max_iter = 20000000, size_t n_threads = 0) {
+    ransac_options options;
+    options.success_rate = success_rate;
+    options.max_iter = max_iter;
+    ransac_parallel(model, points, inliers, sampler, options, n_threads);
+}
+
+template <typename Model>
+inline void ransac_parallel(Model &model, const std::vector<typename Model::point_type> &points, std::vector<unsigned char>& inliers, double success_rate = 0.95, int max_iter = 20000000, size_t n_threads = 0) {
+    ransac_parallel(model, points, inliers, ransac_uniform_sampler(), success_rate, max_iter, n_threads);
+}
+
+/*
+#include <iostream>
+#include "Homography.h"
+#include "unique_timer.h"
+
+// latency of small problems, with and without a ransac_context
+int main() {
+    UniformNoise<double> u(-1, 1);
+    GaussianNoise<double> g(0.5);
+    Eigen::Matrix3d H;
+    H << 1.1, 0.05, 20, -0.03, 0.95, -10, 1e-4, 2e-4, 1;
+
+    for (size_t n : { 100, 250, 500 }) {
+        std::vector<homography_model::point_type> points(n);
+        for (auto &p : points) {
+            Eigen::Vector2d a(u.next() * 500, u.next() * 500);
+            Eigen::Vector2d b = (H*a.homogeneous()).hnormalized() + Eigen::Vector2d(g.next(), g.next());
+            p = { a, u.next() < 0.4 ? b : Eigen::Vector2d(u.next() * 500, u.next() * 500) };
+        }
+
+        homography_model model(9.0);
+        std::vector<unsigned char> inliers;
+        ransac_options options;
+        const int calls = 2000;
+        {
+            auto timer = make_timer<std::chrono::duration<double, std::micro>>([&](double t) { std::cout << n << " points, ransac():         " << t / calls << "us" << std::endl; });
+            for (int i = 0; i < calls; ++i) {
+                ransac(model, points, inliers, ransac_uniform_sampler(), options);
+            }
+        }
+        ransac_context<> context;
+        {
+            auto timer = make_timer<std::chrono::duration<double, std::micro>>([&](double t) { std::cout << n << " points, ransac(context): " << t / calls << "us" << std::endl; });
+            for (int i = 0; i < calls; ++i) {
+                ransac(model, points, inliers, context, options);
+            }
+        }
+    }
+    return 0;
+}
+*/
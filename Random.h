@@ -2,17 +2,196 @@
 
 // the PRNG module in C++ <random> needs too many setup code!
 
+#include <cmath>
+#include <mutex>
+#include <limits>
+#include <cstdint>
 #include <numeric>
 #include <random>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
 #include <type_traits>
+#include "parallel_for.h"
 
 inline unsigned int get_random_seed() {
     static std::random_device rd;
+    static std::mutex rd_mutex;
+    std::lock_guard<std::mutex> lock(rd_mutex);
     return rd();
 }
 
+/*
+    Counter-based generator, Philox4x32-10 from
+    Parallel Random Numbers: As Easy as 1, 2, 3, J. Salmon et al., SC 2011.
+
+    Output n of a stream is a keyed bijection of (n/4, stream), so seeding is free,
+    discard() jumps ahead in O(1), and the streams of one seed are independent:
+    give every thread its own stream for reproducible parallel sampling.
+*/
+class philox_engine {
+public:
+    typedef std::uint32_t result_type;
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return 0xFFFFFFFFu; }
+
+    explicit philox_engine(std::uint64_t value = 0, std::uint64_t stream = 0) {
+        seed(value, stream);
+    }
+
+    void seed(std::uint64_t value = 0, std::uint64_t stream = 0) {
+        key[0] = (std::uint32_t)value;
+        key[1] = (std::uint32_t)(value >> 32);
+        this->stream = stream;
+        offset = 0;
+        block_index = ~std::uint64_t(0);
+    }
+
+    result_type operator()() {
+        std::uint64_t index = offset >> 2;
+        if (index != block_index) {
+            generate(index);
+        }
+        return block[offset++ & 3];
+    }
+
+    // skips n outputs
+    void discard(unsigned long long n) {
+        offset += n;
+    }
+
+    // writes the next n outputs, whole blocks are generated several at a time
+    void fill(result_type *out, size_t n) {
+        while (n > 0 && (offset & 3) != 0) {
+            *out++ = (*this)();
+            n--;
+        }
+        std::uint64_t index = offset >> 2;
+        while (n >= 4 * batch_size) {
+            generate_batch(index, out);
+            index += batch_size;
+            offset += 4 * batch_size;
+            out += 4 * batch_size;
+            n -= 4 * batch_size;
+        }
+        while (n > 0) {
+            *out++ = (*this)();
+            n--;
+        }
+    }
+
+    /*
+        Block index of the n streams starting at first_stream under this seed, in one pass,
+        word j of stream first_stream + l goes to out[j*n + l]. Leaves the engine as it is.
+    */
+    void generate_streams(std::uint64_t index, std::uint64_t first_stream, size_t n, std::uint32_t *out) const {
+        const size_t lanes = 64;
+        std::uint32_t c0[lanes], c1[lanes], c2[lanes], c3[lanes];
+        for (size_t first = 0; first < n; first += lanes) {
+            for (size_t l = 0; l < lanes; ++l) {
+                std::uint64_t s = first_stream + first + l;
+                c0[l] = (std::uint32_t)index;
+                c1[l] = (std::uint32_t)(index >> 32);
+                c2[l] = (std::uint32_t)s;
+                c3[l] = (std::uint32_t)(s >> 32);
+            }
+            rounds<lanes>(c0, c1, c2, c3, key[0], key[1]);
+            size_t m = std::min(lanes, n - first);
+            std::copy(c0, c0 + m, out + first);
+            std::copy(c1, c1 + m, out + n + first);
+            std::copy(c2, c2 + m, out + 2 * n + first);
+            std::copy(c3, c3 + m, out + 3 * n + first);
+        }
+    }
+
+    bool operator==(const philox_engine &e) const {
+        return key[0] == e.key[0] && key[1] == e.key[1] && stream == e.stream && offset == e.offset;
+    }
+
+    bool operator!=(const philox_engine &e) const {
+        return !(*this == e);
+    }
+
+private:
+    void generate(std::uint64_t index) {
+        std::uint32_t c[4] = { (std::uint32_t)index, (std::uint32_t)(index >> 32), (std::uint32_t)stream, (std::uint32_t)(stream >> 32) };
+        std::uint32_t k[2] = { key[0], key[1] };
+        for (int round = 0; round < 10; ++round) {
+            std::uint64_t p0 = (std::uint64_t)0xD2511F53u * c[0];
+            std::uint64_t p1 = (std::uint64_t)0xCD9E8D57u * c[2];
+            std::uint32_t n[4] = { (std::uint32_t)(p1 >> 32) ^ c[1] ^ k[0], (std::uint32_t)p1, (std::uint32_t)(p0 >> 32) ^ c[3] ^ k[1], (std::uint32_t)p0 };
+            c[0] = n[0]; c[1] = n[1]; c[2] = n[2]; c[3] = n[3];
+            k[0] += 0x9E3779B9u;
+            k[1] += 0xBB67AE85u;
+        }
+        block[0] = c[0]; block[1] = c[1]; block[2] = c[2]; block[3] = c[3];
+        block_index = index;
+    }
+
+    static const size_t batch_size = 8;
+
+    // same rounds as generate() over batch_size consecutive blocks
+    void generate_batch(std::uint64_t index, std::uint32_t *out) const {
+        std::uint32_t c0[batch_size], c1[batch_size], c2[batch_size], c3[batch_size];
+        for (size_t l = 0; l < batch_size; ++l) {
+            c0[l] = (std::uint32_t)(index + l);
+            c1[l] = (std::uint32_t)((index + l) >> 32);
+            c2[l] = (std::uint32_t)stream;
+            c3[l] = (std::uint32_t)(stream >> 32);
+        }
+        rounds<batch_size>(c0, c1, c2, c3, key[0], key[1]);
+        for (size_t l = 0; l < batch_size; ++l) {
+            out[4 * l + 0] = c0[l];
+            out[4 * l + 1] = c1[l];
+            out[4 * l + 2] = c2[l];
+            out[4 * l + 3] = c3[l];
+        }
+    }
+
+    // Philox rounds on Lanes counters at once, lanes innermost so they vectorize
+    template <size_t Lanes>
+    static void rounds(std::uint32_t *c0, std::uint32_t *c1, std::uint32_t *c2, std::uint32_t *c3, std::uint32_t k0, std::uint32_t k1) {
+        for (int round = 0; round < 10; ++round) {
+            for (size_t l = 0; l < Lanes; ++l) {
+                std::uint64_t p0 = (std::uint64_t)0xD2511F53u * c0[l];
+                std::uint64_t p1 = (std::uint64_t)0xCD9E8D57u * c2[l];
+                std::uint32_t n0 = (std::uint32_t)(p1 >> 32) ^ c1[l] ^ k0;
+                std::uint32_t n2 = (std::uint32_t)(p0 >> 32) ^ c3[l] ^ k1;
+                c0[l] = n0;
+                c1[l] = (std::uint32_t)p1;
+                c2[l] = n2;
+                c3[l] = (std::uint32_t)p0;
+            }
+            k0 += 0x9E3779B9u;
+            k1 += 0xBB67AE85u;
+        }
+    }
+
+    std::uint32_t key[2];
+    std::uint64_t stream;
+    std::uint64_t offset;
+    std::uint64_t block_index;
+    std::uint32_t block[4];
+};
+
+// generate_n() through fill() and a small buffer, for any output iterator
+template <typename Noise, typename OutputIt>
+OutputIt generate_values(Noise &noise, OutputIt out, size_t n) {
+    typename Noise::value_type buffer[1024];
+    for (size_t i = 0; i < n; i += 1024) {
+        size_t m = std::min(size_t(1024), n - i);
+        noise.fill(buffer, m);
+        out = std::copy(buffer, buffer + m, out);
+    }
+    return out;
+}
+
 class _RandomBase {
 public:
+    typedef philox_engine engine_type;
+
     _RandomBase() {
         seed();
     }
@@ -25,8 +204,63 @@ public:
         engine.seed(value);
     }
 
+    // reproducible sequence, different streams of a seed are independent
+    void seed(std::uint64_t value, std::uint64_t stream) {
+        engine.seed(value, stream);
+    }
+
+    // skips n engine outputs, a sample takes one or more
+    void discard(unsigned long long n) {
+        engine.discard(n);
+    }
+
 protected:
-    std::default_random_engine engine;
+    // uniform in [0, 1) with 53 bits
+    double unit() {
+        std::uint32_t hi = engine(), lo = engine();
+        return ((hi >> 5) * 67108864.0 + (lo >> 6)) * (1.0 / 9007199254740992.0);
+    }
+
+    // engine outputs per uniform value of T
+    template <typename T>
+    static size_t unit_words() {
+        return sizeof(T) <= sizeof(float) ? 1 : 2;
+    }
+
+    // maps engine outputs to uniform values in [0, 1), 24 bits for float and 53 bits otherwise
+    template <typename T>
+    static void to_unit(const std::uint32_t *words, T *u, size_t n) {
+        if (sizeof(T) <= sizeof(float)) {
+            for (size_t i = 0; i < n; ++i) {
+                u[i] = T((words[i] >> 8) * (1.0f / 16777216.0f));
+            }
+        }
+        else {
+            for (size_t i = 0; i < n; ++i) {
+                u[i] = T(((words[2 * i] >> 5) * 67108864.0 + (words[2 * i + 1] >> 6)) * (1.0 / 9007199254740992.0));
+            }
+        }
+    }
+
+    /*
+        Writes n samples made in groups of group_size, each group taking group_words engine outputs,
+        make(engine, out, count) produces count samples from a given engine.
+        Large buffers are split across threads at fixed engine offsets, so the result
+        does not depend on the thread count, and the engine advances past all groups.
+    */
+    template <typename T, typename F>
+    void fill_groups(T *out, size_t n, size_t group_size, size_t group_words, F make) {
+        size_t groups = (n + group_size - 1) / group_size;
+        const engine_type base = engine;
+        parallel_for_chunks(0, groups, [&](size_t lo, size_t hi, size_t) {
+            engine_type e = base;
+            e.discard(lo * group_words);
+            make(e, out + lo * group_size, std::min(n, hi * group_size) - lo * group_size);
+        }, size_t(1) << 16);
+        engine.discard(groups * group_words);
+    }
+
+    engine_type engine;
 };
 
 template <typename T>
@@ -36,10 +270,40 @@ public:
 
     UniformNoise(value_type left = value_type(0.0), value_type right = value_type(1.0)) : distribution(left, right) {}
 
+    using _RandomBase::seed;
+    using _RandomBase::discard;
+
     value_type next() {
         return distribution(engine);
     }
 
+    // bulk version of next(), a different sequence but the same distribution
+    void fill(value_type *out, size_t n) {
+        const value_type left = distribution.a(), width = distribution.b() - distribution.a();
+        const size_t words_per_value = unit_words<value_type>();
+        fill_groups(out, n, 1, words_per_value, [left, width, words_per_value](engine_type &e, value_type *dst, size_t count) {
+            const size_t block = 256;
+            std::uint32_t words[2 * block];
+            for (size_t i = 0; i < count; i += block) {
+                size_t m = std::min(block, count - i);
+                e.fill(words, m * words_per_value);
+                to_unit(words, dst + i, m);
+                for (size_t k = 0; k < m; ++k) {
+                    dst[i + k] = left + width*dst[i + k];
+                }
+            }
+        });
+    }
+
+    void fill(std::vector<value_type> &values) {
+        fill(values.data(), values.size());
+    }
+
+    template <typename OutputIt>
+    OutputIt generate_n(OutputIt out, size_t n) {
+        return generate_values(*this, out, n);
+    }
+
 private:
     std::uniform_real_distribution<value_type> distribution;
 };
@@ -51,9 +315,64 @@ public:
 
     GaussianNoise(value_type sigma = value_type(1.0), value_type mean = value_type(0.0)) : distribution(mean, sigma) {}
 
+    // the distribution caches every other sample, drop it with the old sequence
+    void seed() {
+        _RandomBase::seed();
+        distribution.reset();
+    }
+
+    void seed(unsigned int value) {
+        _RandomBase::seed(value);
+        distribution.reset();
+    }
+
+    void seed(std::uint64_t value, std::uint64_t stream) {
+        _RandomBase::seed(value, stream);
+        distribution.reset();
+    }
+
+    void discard(unsigned long long n) {
+        _RandomBase::discard(n);
+        distribution.reset();
+    }
+
     value_type next() {
         return distribution(engine);
     }
+
+    // bulk version of next() by Box-Muller on pairs, a different sequence but the same distribution
+    void fill(value_type *out, size_t n) {
+        const value_type mean = distribution.mean(), sigma = distribution.stddev();
+        const size_t words_per_value = unit_words<value_type>();
+        fill_groups(out, n, 2, 2 * words_per_value, [mean, sigma, words_per_value](engine_type &e, value_type *dst, size_t count) {
+            const size_t block = 256;
+            std::uint32_t words[2 * block];
+            value_type u[block];
+            value_type z[block];
+            for (size_t i = 0; i < count; i += block) {
+                size_t m = std::min(block, count - i);
+                size_t pairs = (m + 1) / 2;
+                e.fill(words, 2 * pairs * words_per_value);
+                to_unit(words, u, 2 * pairs);
+                for (size_t k = 0; k < pairs; ++k) {
+                    value_type r = sigma*std::sqrt(value_type(-2) * std::log(value_type(1) - u[2 * k]));
+                    value_type t = value_type(6.283185307179586476925) * u[2 * k + 1];
+                    z[2 * k] = mean + r*std::cos(t);
+                    z[2 * k + 1] = mean + r*std::sin(t);
+                }
+                std::copy(z, z + m, dst + i);
+            }
+        });
+    }
+
+    void fill(std::vector<value_type> &values) {
+        fill(values.data(), values.size());
+    }
+
+    template <typename OutputIt>
+    OutputIt generate_n(OutputIt out, size_t n) {
+        return generate_values(*this, out, n);
+    }
 private:
     std::normal_distribution<value_type> distribution;
 };
@@ -66,6 +385,9 @@ public:
     // [left, right]
     UniformInteger(value_type left = value_type(0), value_type right = std::numeric_limits<T>::max()) : distribution(left, right) {}
 
+    using _RandomBase::seed;
+    using _RandomBase::discard;
+
     void param(value_type left, value_type right) {
         distribution.param(std::uniform_int_distribution<value_type>::param_type(left, right));
     }
@@ -132,6 +454,190 @@ private:
     UniformInteger<size_t> dice;
 };
 
+/*
+    Walker's alias method with Vose's construction, for draws from fixed weights in O(1).
+    A Linear Algorithm For Generating Random Numbers With a Given Distribution, M. D. Vose, 1991.
+*/
+class AliasTable : protected _RandomBase {
+public:
+    AliasTable() {}
+
+    AliasTable(const std::vector<double> &weights) {
+        build(weights);
+    }
+
+    using _RandomBase::seed;
+    using _RandomBase::discard;
+
+    // weights need not be normalized, false if none is positive
+    bool build(const std::vector<double> &weights) {
+        size_t n = weights.size();
+        double total = 0.0;
+        for (size_t i = 0; i < n; ++i) {
+            total += std::max(weights[i], 0.0);
+        }
+        prob.assign(n, 1.0);
+        alias.resize(n);
+        std::iota(alias.begin(), alias.end(), 0);
+        if (!(total > 0.0)) {
+            prob.clear();
+            alias.clear();
+            return false;
+        }
+
+        std::vector<double> scaled(n);
+        std::vector<size_t> small, large;
+        for (size_t i = 0; i < n; ++i) {
+            scaled[i] = std::max(weights[i], 0.0) * n / total;
+            (scaled[i] < 1.0 ? small : large).push_back(i);
+        }
+        while (!small.empty() && !large.empty()) {
+            size_t s = small.back(), l = large.back();
+            small.pop_back();
+            prob[s] = scaled[s];
+            alias[s] = l;
+            scaled[l] -= 1.0 - scaled[s];
+            if (scaled[l] < 1.0) {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+        // the rest is 1 up to rounding, prob and alias are already set for it
+        return true;
+    }
+
+    size_t size() const {
+        return prob.size();
+    }
+
+    // size_t(-1) if the table is empty
+    size_t draw() {
+        if (prob.empty()) {
+            return size_t(-1);
+        }
+        // the integer part picks the column, the fraction tosses its coin
+        double x = unit() * prob.size();
+        size_t i = std::min(size_t(x), prob.size() - 1);
+        return (x - i) < prob[i] ? i : alias[i];
+    }
+
+    void draw(size_t *out, size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            out[i] = draw();
+        }
+    }
+
+private:
+    std::vector<double> prob;
+    std::vector<size_t> alias;
+};
+
+/*
+    LotBox with weights kept in a Fenwick tree, so draws and weight updates take O(log n).
+    Drawing without replacement sets the weight of the drawn lot to 0.
+*/
+class WeightedLotBox : protected _RandomBase {
+public:
+    WeightedLotBox(size_t size = 0, double weight = 1.0) {
+        assign(std::vector<double>(size, weight));
+    }
+
+    WeightedLotBox(const std::vector<double> &weights) {
+        assign(weights);
+    }
+
+    using _RandomBase::seed;
+    using _RandomBase::discard;
+
+    void assign(const std::vector<double> &weights) {
+        this->weights.resize(weights.size());
+        for (size_t i = 0; i < weights.size(); ++i) {
+            this->weights[i] = std::max(weights[i], 0.0);
+        }
+        rebuild();
+    }
+
+    size_t size() const {
+        return weights.size();
+    }
+
+    double weight(size_t i) const {
+        return weights[i];
+    }
+
+    void set_weight(size_t i, double w) {
+        w = std::max(w, 0.0);
+        double delta = w - weights[i];
+        weights[i] = w;
+        for (size_t k = i + 1; k <= tree.size(); k += k & (0 - k)) {
+            tree[k - 1] += delta;
+        }
+        // bound the rounding drift of the partial sums
+        if (++updates > tree.size()) {
+            rebuild();
+        }
+    }
+
+    double total() const {
+        double sum = 0.0;
+        for (size_t k = tree.size(); k > 0; k -= k & (0 - k)) {
+            sum += tree[k - 1];
+        }
+        return sum;
+    }
+
+    // size_t(-1) if all weights are 0
+    size_t draw_with_replacement() {
+        double sum = total();
+        if (!(sum > 0.0)) {
+            return size_t(-1);
+        }
+        double target = unit() * sum;
+        size_t pos = 0;
+        for (size_t step = top; step > 0; step >>= 1) {
+            if (pos + step <= tree.size() && tree[pos + step - 1] <= target) {
+                pos += step;
+                target -= tree[pos - 1];
+            }
+        }
+        // rounding may run past the last positive lot
+        pos = std::min(pos, weights.size() - 1);
+        while (pos > 0 && weights[pos] <= 0.0) {
+            pos--;
+        }
+        return pos;
+    }
+
+    size_t draw_without_replacement() {
+        size_t result = draw_with_replacement();
+        if (result != size_t(-1)) {
+            set_weight(result, 0.0);
+        }
+        return result;
+    }
+
+private:
+    void rebuild() {
+        tree = weights;
+        for (size_t k = 1; k <= tree.size(); ++k) {
+            size_t parent = k + (k & (0 - k));
+            if (parent <= tree.size()) {
+                tree[parent - 1] += tree[k - 1];
+            }
+        }
+        top = 1;
+        while (top * 2 <= tree.size()) {
+            top *= 2;
+        }
+        updates = 0;
+    }
+
+    std::vector<double> weights;
+    std::vector<double> tree;
+    size_t top = 1;
+    size_t updates = 0;
+};
+
 template<typename T>
 class WhiteNoise {
 public:
@@ -146,10 +652,31 @@ public:
         n.seed(value);
     }
 
+    void seed(std::uint64_t value, std::uint64_t stream) {
+        n.seed(value, stream);
+    }
+
     value_type next() {
         return n.next()*isdt;
     }
 
+    void fill(value_type *out, size_t count) {
+        n.fill(out, count);
+        const value_type scale = value_type(isdt);
+        for (size_t i = 0; i < count; ++i) {
+            out[i] *= scale;
+        }
+    }
+
+    void fill(std::vector<value_type> &values) {
+        fill(values.data(), values.size());
+    }
+
+    template <typename OutputIt>
+    OutputIt generate_n(OutputIt out, size_t count) {
+        return generate_values(*this, out, count);
+    }
+
 private:
     GaussianNoise<value_type> n;
     double isdt;
@@ -170,6 +697,10 @@ public:
         n.seed(value);
     }
 
+    void seed(std::uint64_t value, std::uint64_t stream) {
+        n.seed(value, stream);
+    }
+
     void init(const value_type &v) {
         this->v = v;
     }
@@ -188,3 +719,565 @@ private:
     GaussianNoise<value_type> n;
     double sdt;
 };
+
+/*
+    Standard normal samples for many channels at once, one per channel on each next().
+    Channel c draws from stream c of the seed, so its sequence does not depend on the
+    channel count. Each Philox block serves several ticks, all channels are refilled in one pass.
+*/
+template <typename T>
+class GaussianBank : protected _RandomBase {
+public:
+    typedef T value_type;
+
+    GaussianBank(size_t channels) : n(channels), tick(0), words(4 * channels), z(per_block() * channels) {}
+
+    void seed() {
+        _RandomBase::seed();
+        tick = 0;
+    }
+
+    void seed(std::uint64_t value) {
+        engine.seed(value);
+        tick = 0;
+    }
+
+    size_t size() const {
+        return n;
+    }
+
+    // n samples of the next tick, valid until the following call
+    const value_type *next() {
+        const size_t k = per_block();
+        if (tick % k == 0) {
+            refill(tick / k);
+        }
+        return &z[(tick++ % k) * n];
+    }
+
+private:
+    // float takes one engine output per uniform, double two, and Box-Muller makes a sample of each uniform
+    static size_t per_block() {
+        return 4 / unit_words<value_type>();
+    }
+
+    void refill(std::uint64_t index) {
+        engine.generate_streams(index, 0, n, words.data());
+        const size_t k = per_block();
+        for (size_t j = 0; j < k; j += 2) {
+            value_type *z0 = &z[j * n];
+            value_type *z1 = &z[(j + 1) * n];
+            for (size_t c = 0; c < n; ++c) {
+                value_type u0, u1;
+                if (k == 4) {
+                    u0 = value_type((words[j * n + c] >> 8) * (1.0f / 16777216.0f));
+                    u1 = value_type((words[(j + 1) * n + c] >> 8) * (1.0f / 16777216.0f));
+                }
+                else {
+                    u0 = value_type(((words[c] >> 5) * 67108864.0 + (words[n + c] >> 6)) * (1.0 / 9007199254740992.0));
+                    u1 = value_type(((words[2 * n + c] >> 5) * 67108864.0 + (words[3 * n + c] >> 6)) * (1.0 / 9007199254740992.0));
+                }
+                value_type r = std::sqrt(value_type(-2) * std::log(value_type(1) - u0));
+                value_type t = value_type(6.283185307179586476925) * u1;
+                z0[c] = r*std::cos(t);
+                z1[c] = r*std::sin(t);
+            }
+        }
+    }
+
+    size_t n;
+    std::uint64_t tick;
+    std::vector<std::uint32_t> words;
+    std::vector<value_type> z;
+};
+
+/*
+    WhiteNoise over many channels with per channel sigma and mean,
+    next() returns the samples of all channels for one tick.
+*/
+template <typename T>
+class WhiteNoiseBank {
+public:
+    typedef T value_type;
+
+    WhiteNoiseBank(size_t channels, value_type sigma, value_type freq = 1, value_type mean = 0) : n(channels), sigma(channels, sigma), mean(channels, mean), values(channels), isdt(sqrt(freq)) {}
+
+    void seed() {
+        n.seed();
+    }
+
+    void seed(std::uint64_t value) {
+        n.seed(value);
+    }
+
+    size_t size() const {
+        return values.size();
+    }
+
+    void set_channel(size_t c, value_type sigma, value_type mean = 0) {
+        this->sigma[c] = sigma;
+        this->mean[c] = mean;
+    }
+
+    const std::vector<value_type> &next() {
+        const value_type *z = n.next();
+        const value_type s = value_type(isdt);
+        for (size_t c = 0; c < values.size(); ++c) {
+            values[c] = mean[c] + sigma[c] * s * z[c];
+        }
+        return values;
+    }
+
+private:
+    GaussianBank<value_type> n;
+    std::vector<value_type> sigma;
+    std::vector<value_type> mean;
+    std::vector<value_type> values;
+    double isdt;
+};
+
+/*
+    RandomWalk over many channels with per channel sigma and bias, e.g. the bias drift
+    of every axis of every IMU in a simulation. The states are contiguous and
+    next() advances all of them in one pass.
+*/
+template <typename T>
+class RandomWalkBank {
+public:
+    typedef T value_type;
+
+    RandomWalkBank(size_t channels, value_type sigma, value_type freq = 1, value_type init = 0, value_type bias = 0) : n(channels), sigma(channels, sigma), bias(channels, bias), v(channels, init), sdt(sqrt(1 / freq)) {}
+
+    void seed() {
+        n.seed();
+    }
+
+    void seed(std::uint64_t value) {
+        n.seed(value);
+    }
+
+    size_t size() const {
+        return v.size();
+    }
+
+    void set_channel(size_t c, value_type sigma, value_type bias = 0) {
+        this->sigma[c] = sigma;
+        this->bias[c] = bias;
+    }
+
+    void init(const value_type &v) {
+        std::fill(this->v.begin(), this->v.end(), v);
+    }
+
+    void init(size_t c, const value_type &v) {
+        this->v[c] = v;
+    }
+
+    const std::vector<value_type> &next() {
+        const value_type *z = n.next();
+        const value_type s = value_type(sdt);
+        for (size_t c = 0; c < v.size(); ++c) {
+            v[c] += (bias[c] + sigma[c] * z[c]) * s;
+        }
+        return v;
+    }
+
+private:
+    GaussianBank<value_type> n;
+    std::vector<value_type> sigma;
+    std::vector<value_type> bias;
+    std::vector<value_type> v;
+    double sdt;
+};
+
+/*
+    Sobol sequence of any dimension, x = at(index, j) in [0, 1) with random access,
+    so threads can take disjoint index ranges without coordination. Indices below 2^52.
+    The direction numbers come from the primitive polynomials in order of degree with
+    fixed odd initial values. load() reads the tuned ones of S. Joe and F. Y. Kuo
+    (new-joe-kuo-6.21201, "d s a m_i" lines) for better low dimensional projections.
+*/
+class SobolSequence {
+public:
+    SobolSequence(size_t dims = 1) {
+        generate(dims);
+    }
+
+    size_t dimension() const {
+        return directions.size() / bits;
+    }
+
+    // builtin direction numbers
+    void generate(size_t dims) {
+        directions.assign(dims * bits, 0);
+        shifts.assign(dims, 0);
+        philox_engine rng(0x5AB01u);
+        std::uint32_t poly = 1;
+        for (size_t j = 0; j < dims; ++j) {
+            if (j == 0) {
+                van_der_corput();
+                continue;
+            }
+            do {
+                poly += 2;
+            } while (!is_primitive(poly));
+            int s = degree(poly);
+            std::vector<std::uint64_t> m(s);
+            for (int k = 0; k < s; ++k) {
+                m[k] = (rng() & ((std::uint64_t(1) << (k + 1)) - 1)) | 1;
+            }
+            // the coefficients between the leading and the constant term
+            set_dimension(j, s, (poly >> 1) & ((1u << (s - 1)) - 1), m);
+        }
+    }
+
+    // false if the file cannot be read or has fewer than dims - 1 lines
+    bool load(const std::string &path, size_t dims) {
+        std::ifstream file(path);
+        if (!file) return false;
+        std::string header;
+        std::getline(file, header);
+        directions.assign(dims * bits, 0);
+        shifts.assign(dims, 0);
+        if (dims > 0) {
+            van_der_corput();
+        }
+        for (size_t j = 1; j < dims; ++j) {
+            int d, s;
+            std::uint32_t a;
+            if (!(file >> d >> s >> a) || s < 1 || s >= bits) return false;
+            std::vector<std::uint64_t> m(s);
+            for (int k = 0; k < s; ++k) {
+                if (!(file >> m[k])) return false;
+            }
+            set_dimension(j, s, a, m);
+        }
+        return true;
+    }
+
+    // random digital shift per dimension, 0 restores the plain sequence
+    void scramble(std::uint64_t seed) {
+        philox_engine rng(seed, 1);
+        for (size_t j = 0; j < shifts.size(); ++j) {
+            shifts[j] = 0;
+            if (seed != 0) {
+                std::uint64_t hi = rng(), lo = rng();
+                shifts[j] = ((hi << 32) | lo) >> (64 - bits);
+            }
+        }
+    }
+
+    double at(std::uint64_t index, size_t dim) const {
+        const std::uint64_t *v = &directions[dim * bits];
+        std::uint64_t gray = index ^ (index >> 1);
+        std::uint64_t x = shifts[dim];
+        for (int k = 0; gray != 0; ++k, gray >>= 1) {
+            if (gray & 1) {
+                x ^= v[k];
+            }
+        }
+        return x * scale();
+    }
+
+    // all coordinates of one point
+    void point(std::uint64_t index, double *out) const {
+        for (size_t j = 0; j < shifts.size(); ++j) {
+            out[j] = at(index, j);
+        }
+    }
+
+    // count points from first, point i at out[i*dimension()], consecutive points differ by one direction number
+    void fill(std::uint64_t first, size_t count, double *out) const {
+        const size_t dims = shifts.size();
+        std::vector<std::uint64_t> x(dims);
+        std::uint64_t gray = first ^ (first >> 1);
+        for (size_t j = 0; j < dims; ++j) {
+            x[j] = shifts[j];
+            for (int k = 0; k < bits; ++k) {
+                if ((gray >> k) & 1) {
+                    x[j] ^= directions[j * bits + k];
+                }
+            }
+        }
+        for (size_t i = 0; i < count; ++i) {
+            if (i > 0) {
+                int k = trailing_zeros(first + i);
+                for (size_t j = 0; j < dims; ++j) {
+                    x[j] ^= directions[j * bits + k];
+                }
+            }
+            for (size_t j = 0; j < dims; ++j) {
+                out[i * dims + j] = x[j] * scale();
+            }
+        }
+    }
+
+private:
+    static const int bits = 52;
+
+    static double scale() {
+        return 1.0 / 4503599627370496.0;
+    }
+
+    void van_der_corput() {
+        for (int k = 0; k < bits; ++k) {
+            directions[k] = std::uint64_t(1) << (bits - 1 - k);
+        }
+    }
+
+    // Bratley and Fox recurrence on m_k, poly holds a_1 .. a_(s-1) with a_1 highest
+    void set_dimension(size_t j, int s, std::uint32_t poly, const std::vector<std::uint64_t> &initial) {
+        std::vector<std::uint64_t> m(bits);
+        for (int k = 0; k < s && k < bits; ++k) {
+            m[k] = initial[k];
+        }
+        for (int k = s; k < bits; ++k) {
+            std::uint64_t mk = m[k - s] ^ (m[k - s] << s);
+            for (int i = 1; i < s; ++i) {
+                if ((poly >> (s - 1 - i)) & 1) {
+                    mk ^= m[k - i] << i;
+                }
+            }
+            m[k] = mk;
+        }
+        for (int k = 0; k < bits; ++k) {
+            directions[j * bits + k] = m[k] << (bits - 1 - k);
+        }
+    }
+
+    static int degree(std::uint32_t poly) {
+        int d = 0;
+        while (poly >> (d + 1)) {
+            d++;
+        }
+        return d;
+    }
+
+    static int trailing_zeros(std::uint64_t x) {
+        int k = 0;
+        while ((x & 1) == 0) {
+            x >>= 1;
+            k++;
+        }
+        return k;
+    }
+
+    // a * b mod poly over GF(2), poly of degree s
+    static std::uint64_t mulmod(std::uint64_t a, std::uint64_t b, std::uint64_t poly, int s) {
+        std::uint64_t r = 0;
+        while (b != 0) {
+            if (b & 1) {
+                r ^= a;
+            }
+            b >>= 1;
+            a <<= 1;
+            if ((a >> s) & 1) {
+                a ^= poly;
+            }
+        }
+        return r;
+    }
+
+    static std::uint64_t powmod(std::uint64_t a, std::uint64_t e, std::uint64_t poly, int s) {
+        std::uint64_t r = 1;
+        while (e != 0) {
+            if (e & 1) {
+                r = mulmod(r, a, poly, s);
+            }
+            a = mulmod(a, a, poly, s);
+            e >>= 1;
+        }
+        return r;
+    }
+
+    // x generates the whole multiplicative group mod poly
+    static bool is_primitive(std::uint32_t poly) {
+        int s = degree(poly);
+        if (s == 1) {
+            return true;
+        }
+        std::uint64_t order = (std::uint64_t(1) << s) - 1;
+        std::uint64_t x = 2;
+        if (powmod(x, order, poly, s) != 1) {
+            return false;
+        }
+        std::uint64_t rest = order;
+        for (std::uint64_t q = 3; q * q <= rest; q += 2) {
+            if (rest % q == 0) {
+                if (powmod(x, order / q, poly, s) == 1) {
+                    return false;
+                }
+                while (rest % q == 0) {
+                    rest /= q;
+                }
+            }
+        }
+        return rest == 1 || rest == order || powmod(x, order / rest, poly, s) != 1;
+    }
+
+    std::vector<std::uint64_t> directions;
+    std::vector<std::uint64_t> shifts;
+};
+
+/*
+    Halton sequence, dimension j takes the radical inverse of the index in the j-th prime.
+    scramble() permutes the nonzero digits of every base at random, which removes
+    the correlation between the higher dimensions of the plain sequence.
+*/
+class HaltonSequence {
+public:
+    HaltonSequence(size_t dims = 1) {
+        bases.clear();
+        for (std::uint32_t p = 2; bases.size() < dims; ++p) {
+            bool prime = true;
+            for (size_t i = 0; i < bases.size() && bases[i] * bases[i] <= p; ++i) {
+                if (p % bases[i] == 0) {
+                    prime = false;
+                    break;
+                }
+            }
+            if (prime) {
+                bases.push_back(p);
+            }
+        }
+        scramble(0);
+    }
+
+    size_t dimension() const {
+        return bases.size();
+    }
+
+    // 0 restores the plain sequence
+    void scramble(std::uint64_t seed) {
+        philox_engine rng(seed, 2);
+        permutations.resize(bases.size());
+        for (size_t j = 0; j < bases.size(); ++j) {
+            std::vector<std::uint32_t> &perm = permutations[j];
+            perm.resize(bases[j]);
+            std::iota(perm.begin(), perm.end(), 0);
+            if (seed != 0) {
+                // 0 stays put, or the infinite trailing zeros would add up
+                for (size_t i = perm.size() - 1; i > 1; --i) {
+                    std::swap(perm[i], perm[1 + rng() % i]);
+                }
+            }
+        }
+    }
+
+    double at(std::uint64_t index, size_t dim) const {
+        const std::uint32_t b = bases[dim];
+        const std::uint32_t *perm = permutations[dim].data();
+        const double inv = 1.0 / b;
+        double f = inv, x = 0.0;
+        while (index != 0) {
+            x += perm[index % b] * f;
+            index /= b;
+            f *= inv;
+        }
+        return std::min(x, 1.0 - std::numeric_limits<double>::epsilon() / 2);
+    }
+
+    // all coordinates of one point
+    void point(std::uint64_t index, double *out) const {
+        for (size_t j = 0; j < bases.size(); ++j) {
+            out[j] = at(index, j);
+        }
+    }
+
+    void fill(std::uint64_t first, size_t count, double *out) const {
+        for (size_t i = 0; i < count; ++i) {
+            point(first + i, out + i * bases.size());
+        }
+    }
+
+private:
+    std::vector<std::uint32_t> bases;
+    std::vector<std::vector<std::uint32_t>> permutations;
+};
+
+/*
+    Additive recurrence x_n = frac(x_0 + n*alpha) with alpha_j = phi^-(j+1) and phi^(d+1) = phi + 1,
+    the R_d sequence of M. Roberts. The recurrence runs in 64 bit fixed point, so at() is exact
+    for every index. scramble() picks a random x_0 (Cranley-Patterson rotation).
+*/
+class RdSequence {
+public:
+    RdSequence(size_t dims = 1) : alphas(dims), offsets(dims) {
+        // Newton on x^(d+1) - x - 1 from the right of the root
+        double phi = 2.0;
+        for (int i = 0; i < 64; ++i) {
+            phi -= (std::pow(phi, double(dims + 1)) - phi - 1.0) / ((dims + 1) * std::pow(phi, double(dims)) - 1.0);
+        }
+        double a = 1.0;
+        for (size_t j = 0; j < dims; ++j) {
+            a /= phi;
+            alphas[j] = (std::uint64_t)std::ldexp(a, 64);
+        }
+        scramble(0);
+    }
+
+    size_t dimension() const {
+        return alphas.size();
+    }
+
+    // 0 restores x_0 = 0.5
+    void scramble(std::uint64_t seed) {
+        philox_engine rng(seed, 3);
+        for (size_t j = 0; j < offsets.size(); ++j) {
+            offsets[j] = std::uint64_t(1) << 63;
+            if (seed != 0) {
+                std::uint64_t hi = rng(), lo = rng();
+                offsets[j] = (hi << 32) | lo;
+            }
+        }
+    }
+
+    double at(std::uint64_t index, size_t dim) const {
+        return ((offsets[dim] + index * alphas[dim]) >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    // all coordinates of one point
+    void point(std::uint64_t index, double *out) const {
+        for (size_t j = 0; j < alphas.size(); ++j) {
+            out[j] = at(index, j);
+        }
+    }
+
+    void fill(std::uint64_t first, size_t count, double *out) const {
+        const size_t dims = alphas.size();
+        for (size_t i = 0; i < count; ++i) {
+            for (size_t j = 0; j < dims; ++j) {
+                out[i * dims + j] = at(first + i, j);
+            }
+        }
+    }
+
+private:
+    std::vector<std::uint64_t> alphas;
+    std::vector<std::uint64_t> offsets;
+};
+
+/*
+#include <iostream>
+#include "Random.h"
+#include "unique_timer.h"
+
+// samples/sec of next() against fill()
+int main() {
+    const size_t n = 100000000;
+    std::vector<float> samples(n);
+    GaussianNoise<float> noise;
+    noise.seed(42, 0);
+    {
+        auto timer = make_timer<std::chrono::duration<double>>([n](double t) { std::cout << "next(): " << n / t << " samples/sec" << std::endl; });
+        for (size_t i = 0; i < n; ++i) {
+            samples[i] = noise.next();
+        }
+    }
+    {
+        auto timer = make_timer<std::chrono::duration<double>>([n](double t) { std::cout << "fill(): " << n / t << " samples/sec" << std::endl; });
+        noise.fill(samples);
+    }
+    return 0;
+}
+*/
@@ -2,20 +2,64 @@
 
 /*
     A simple remeshing code.
-    Written and tested with OpenMesh 3.2
+
+    Collapses and flips run in parallel batches: each batch is an independent set of
+    edges whose one-ring regions do not overlap, conflicting edges are retried in the next batch.
+    Batches are picked in parallel too, every edge claims its region with an atomic minimum of a hashed priority,
+    only the final gathering of the batch into a list is serial.
+    Splits allocate new elements, so only their candidate search is parallel. A split phase leaves no long edge,
+    so the next one only looks at edges around vertices touched since, heap entries are invalidated lazily.
+    Smoothing runs in parallel on a flattened snapshot of the one-rings.
+    Garbage collection is deferred until the deleted vertices exceed a fraction of all vertices,
+    phases skip deleted elements by their status until then.
+
+    Target edge length is a per-vertex sizing field, an edge targets the mean of its end points.
+    It is either uniform, user supplied, or derived from curvature with remesh_adaptive().
+
+    Smoothed vertices are projected back onto a copy of the input surface kept in a BVH.
+    Edges whose dihedral angle exceeds the feature angle, or marked as feature by the caller, are creases:
+    they are never flipped or collapsed, their vertices are not smoothed, and their split halves stay creases.
+    Flips and collapses that would leave a degenerate face or turn a face over are skipped.
+    With set_lock_boundary() no flip or collapse joins two boundary vertices by a new edge, boundary edges
+    only change by midpoint splits, so meshes remeshed on both sides of a shared boundary still match along it.
+
+    basic_remesher works on any mesh providing the OpenMesh TriMesh subset implemented by halfedge_mesh,
+    it only traverses the mesh by halfedge navigation. remesher_compact runs on halfedge_mesh and needs no OpenMesh,
+    remesher runs on OpenMesh and is declared in RemeshOpenMesh.h.
 */
 
+#define _USE_MATH_DEFINES
+#include <cmath>
 #include <vector>
 #include <queue>
+#include <atomic>
+#include <limits>
+#include <algorithm>
 #include <iostream>
-#include <OpenMesh/Core/IO/MeshIO.hh>
-#include <OpenMesh/Core/Mesh/TriMesh_ArrayKernelT.hh>
-
-class remesher {
+#include "parallel_for.h"
+#include "TriangleBVH.h"
+#include "HalfedgeMesh.h"
+#include "unique_timer.h"
+
+// vertex property handle type of a mesh kernel, specialized for kernels that do not nest it
+template <typename Mesh, typename T>
+struct remesher_vertex_property {
+    typedef typename Mesh::template VPropHandleT<T> type;
+};
+
+template <typename Mesh>
+class basic_remesher {
 public:
-    typedef OpenMesh::TriMesh_ArrayKernelT<> mesh_type;
-
-    remesher(mesh_type &mesh) : mesh(mesh) {
+    typedef Mesh mesh_type;
+    typedef typename mesh_type::Point Point;
+    typedef typename mesh_type::Normal Normal;
+    typedef typename mesh_type::VertexHandle VertexHandle;
+    typedef typename mesh_type::HalfedgeHandle HalfedgeHandle;
+    typedef typename mesh_type::EdgeHandle EdgeHandle;
+    typedef typename mesh_type::FaceHandle FaceHandle;
+    template <typename T> using vertex_property = typename remesher_vertex_property<mesh_type, T>::type;
+
+    basic_remesher(mesh_type &mesh) : mesh(mesh) {
         if (!test_manifold()) {
             std::cout << "Mesh is not 2-manifold, remesher may run into error." << std::endl;
             return;
@@ -23,188 +67,689 @@ public:
         prepare_valence();
         prepare_normal();
         prepare_status();
+        prepare_sizing();
+        prepare_touched();
     }
 
+    // seconds spent in each phase by the last remesh()
+    struct phase_timings {
+        double split = 0.0;
+        double collapse = 0.0;
+        double flip = 0.0;
+        double smooth = 0.0;
+        double project = 0.0;
+        double gc = 0.0;
+    };
+
     void remesh(float target_edge_len, size_t max_iter) {
-        float edge_len_lo = 0.8f*target_edge_len;
-        float edge_len_hi = 4.0f / 3.0f*target_edge_len;
+        for (size_t i = 0; i < mesh.n_vertices(); ++i) {
+            mesh.property(sizing_ph, VertexHandle((int)i)) = target_edge_len;
+        }
+        remesh_iterations(max_iter);
+    }
+
+    // target edge length per vertex given by a user property
+    void remesh(const vertex_property<float> &target_edge_len_ph, size_t max_iter) {
+        for (size_t i = 0; i < mesh.n_vertices(); ++i) {
+            VertexHandle vh((int)i);
+            mesh.property(sizing_ph, vh) = mesh.property(target_edge_len_ph, vh);
+        }
+        remesh_iterations(max_iter);
+    }
 
-        mesh.add_property(npoint_ph);
+    /*
+        Target edge length from curvature: an edge of length L on a circle of curvature k
+        deviates from it by at most e when L = sqrt(6e/k - 3e^2), clamped to [min_len, max_len].
+    */
+    void remesh_adaptive(float min_edge_len, float max_edge_len, float max_error, size_t max_iter) {
+        prepare_curvature_sizing(min_edge_len, max_edge_len, max_error);
+        remesh_iterations(max_iter);
+    }
+
+    const phase_timings &get_phase_timings() const {
+        return timings;
+    }
+
+    float get_gc_threshold() const {
+        return gc_threshold;
+    }
 
+    // fraction of deleted vertices that triggers garbage collection between iterations, 0 collects every iteration
+    void set_gc_threshold(float threshold) {
+        gc_threshold = threshold;
+    }
+
+    float get_feature_angle() const {
+        return feature_angle;
+    }
+
+    // dihedral angle in degrees above which an edge is a crease, 0 keeps only the features marked by the caller
+    void set_feature_angle(float degrees) {
+        feature_angle = degrees;
+    }
+
+    bool get_project_to_surface() const {
+        return project_to_surface;
+    }
+
+    void set_project_to_surface(bool project) {
+        project_to_surface = project;
+    }
+
+    bool get_lock_boundary() const {
+        return lock_boundary;
+    }
+
+    // no new edge between boundary vertices, for meshes whose boundaries must keep matching a neighbor
+    void set_lock_boundary(bool lock) {
+        lock_boundary = lock;
+    }
+
+private:
+    // edge weights are squared lengths relative to the target length
+    static constexpr float edge_weight_lo = 0.8f*0.8f;
+    static constexpr float edge_weight_hi = (4.0f / 3.0f)*(4.0f / 3.0f);
+    // twice the area of a face below this times its longest edge squared is degenerate
+    static constexpr float face_area_min = 1e-3f;
+
+    void remesh_iterations(size_t max_iter) {
+        timings = phase_timings();
+        // the sizing field has changed, every edge is a split candidate
+        parallel_for(0, mesh.n_vertices(), [this](size_t i) {
+            mesh.property(touched_ph, VertexHandle((int)i)) = 1;
+        });
+        prepare_features();
+        timed(timings.project, [&] { prepare_reference(); });
         for (size_t n_iter = 0; n_iter < max_iter; ++n_iter) {
-            split_longer(edge_len_hi*edge_len_hi);
-            collapse_shorter(edge_len_lo*edge_len_lo, edge_len_hi*edge_len_hi);
-            adjust_valence();
-            smooth(5, 0.2f, true);
-            force_gc();
+            timed(timings.split, [&] { split_longer(edge_weight_hi); });
+            timed(timings.collapse, [&] { collapse_shorter(edge_weight_lo, edge_weight_hi); });
+            timed(timings.flip, [&] { adjust_valence(); });
+            timed(timings.smooth, [&] { smooth(5, 0.2f, true); });
+            timed(timings.project, [&] { project(); });
+            timed(timings.gc, [&] { collect_garbage(); });
         }
 
-        smooth(2, 0.5f, false);
-        mesh.remove_property(npoint_ph);
-        force_gc();
+        timed(timings.smooth, [&] { smooth(2, 0.5f, false); });
+        timed(timings.project, [&] { project(); });
+        timed(timings.gc, [&] { force_gc(); });
+        reference = TriangleBVH();
     }
 
-private:
     struct weighted_edge {
-        mesh_type::EdgeHandle handle;
+        EdgeHandle handle;
         float weight;
 
-        weighted_edge(const mesh_type::EdgeHandle &handle, float weight) : handle(handle), weight(weight) {}
+        weighted_edge(const EdgeHandle &handle, float weight) : handle(handle), weight(weight) {}
 
         bool operator< (const weighted_edge &e) const {
             return weight < e.weight;
         }
     };
 
+    // heap entry of split_longer, stale once the edge stamp has moved on
+    struct stamped_edge {
+        EdgeHandle handle;
+        float weight;
+        unsigned int stamp;
+
+        stamped_edge(const EdgeHandle &handle, float weight, unsigned int stamp) : handle(handle), weight(weight), stamp(stamp) {}
+
+        bool operator< (const stamped_edge &e) const {
+            return weight < e.weight;
+        }
+    };
+
     void split_longer(float target_weight) {
-        std::priority_queue<weighted_edge, std::vector<weighted_edge>> edge_to_split;
+        std::priority_queue<stamped_edge, std::vector<stamped_edge>> edge_to_split;
 
-        for (mesh_type::EdgeIter e_it = mesh.edges_sbegin(); e_it != mesh.edges_end(); ++e_it) {
-            float weight = edge_weight(*e_it);
-            if (weight > target_weight) {
-                edge_to_split.emplace(*e_it, weight);
-            }
+        edge_stamps.assign(mesh.n_edges(), 0);
+        std::vector<weighted_edge> candidates = select_touched_edges(target_weight);
+        for (size_t i = 0; i < candidates.size(); ++i) {
+            edge_to_split.emplace(candidates[i].handle, candidates[i].weight, 0);
         }
 
         while (!edge_to_split.empty()) {
-            weighted_edge e = edge_to_split.top();
+            stamped_edge e = edge_to_split.top();
             edge_to_split.pop();
+            if (e.stamp != edge_stamps[e.handle.idx()]) continue;
+            edge_stamps[e.handle.idx()]++;
             // split
-            mesh_type::HalfedgeHandle heh = mesh.halfedge_handle(e.handle, 0);
-            mesh_type::VertexHandle vh_from = mesh.from_vertex_handle(heh);
-            mesh_type::VertexHandle vh_to = mesh.to_vertex_handle(heh);
-            mesh_type::Point pt_from = mesh.point(vh_from);
-            mesh_type::Point pt_to = mesh.point(vh_to);
-
-            mesh_type::Point pt_mid = 0.5f*(pt_from + pt_to);
-            mesh_type::VertexHandle vh_mid = mesh.split(e.handle, pt_mid);
+            HalfedgeHandle heh = mesh.halfedge_handle(e.handle, 0);
+            VertexHandle vh_from = mesh.from_vertex_handle(heh);
+            VertexHandle vh_to = mesh.to_vertex_handle(heh);
+            Point pt_from = mesh.point(vh_from);
+            Point pt_to = mesh.point(vh_to);
+
+            Point pt_mid = 0.5f*(pt_from + pt_to);
+            bool feature = mesh.status(e.handle).feature();
+            VertexHandle vh_mid = mesh.split(e.handle, pt_mid);
+            edge_stamps.resize(mesh.n_edges(), 0);
+            mesh.property(sizing_ph, vh_mid) = 0.5f*(mesh.property(sizing_ph, vh_from) + mesh.property(sizing_ph, vh_to));
+
+            // both halves of a crease stay on the crease
+            if (feature) {
+                mesh.status(vh_mid).set_feature(true);
+                for_each_outgoing(vh_mid, [this, vh_from, vh_to](const HalfedgeHandle &h) {
+                    VertexHandle vh = mesh.to_vertex_handle(h);
+                    if (vh == vh_from || vh == vh_to) {
+                        mesh.status(mesh.edge_handle(h)).set_feature(true);
+                    }
+                });
+            }
 
             // update valence
             mesh.property(valence_ph, vh_mid) = mesh.is_boundary(vh_mid) ? 3 : 4;
-            for (mesh_type::VertexVertexIter vv_it = mesh.vv_begin(vh_mid); vv_it != mesh.vv_end(vh_mid); ++vv_it) {
-                if ((*vv_it != vh_from) && (*vv_it != vh_to)) {
-                    mesh.property(valence_ph, *vv_it)++;
+            for_each_outgoing(vh_mid, [this, vh_from, vh_to](const HalfedgeHandle &h) {
+                VertexHandle vh = mesh.to_vertex_handle(h);
+                if ((vh != vh_from) && (vh != vh_to)) {
+                    mesh.property(valence_ph, vh)++;
                 }
-            }
+            });
 
             // update normal
+            for_each_outgoing(vh_mid, [this](const HalfedgeHandle &h) {
+                FaceHandle fh = mesh.face_handle(h);
+                if (fh.is_valid()) {
+                    mesh.set_normal(fh, mesh.calc_face_normal(fh));
+                }
+            });
             mesh.set_normal(vh_mid, mesh.calc_vertex_normal(vh_mid));
-            for (mesh_type::VertexFaceIter vf_it = mesh.vf_begin(vh_mid); vf_it != mesh.vf_end(vh_mid); ++vf_it) {
-                mesh.set_normal(*vf_it, mesh.calc_face_normal(*vf_it));
-            }
 
             // add new edges if heavier than weight
-            for (mesh_type::VertexEdgeIter ve_it = mesh.ve_begin(vh_mid); ve_it != mesh.ve_end(vh_mid); ++ve_it) {
-                float weight = edge_weight(*ve_it);
+            for_each_outgoing(vh_mid, [this, target_weight, &edge_to_split](const HalfedgeHandle &h) {
+                EdgeHandle eh = mesh.edge_handle(h);
+                float weight = edge_weight(eh);
                 if (weight > target_weight) {
-                    edge_to_split.emplace(*ve_it, weight);
+                    edge_to_split.emplace(eh, weight, edge_stamps[eh.idx()]);
                 }
-            }
+            });
         }
     }
 
     void collapse_shorter(float target_weight_lo, float target_weight_hi) {
-        std::vector<weighted_edge> edge_to_collapse;
-        for (mesh_type::EdgeIter e_it = mesh.edges_sbegin(); e_it != mesh.edges_end(); ++e_it) {
-            float weight = edge_weight(*e_it);
-            if (weight < target_weight_lo) {
-                edge_to_collapse.emplace_back(*e_it, weight);
-            }
-        }
-        for (size_t i = 0; i < edge_to_collapse.size(); ++i) {
-            mesh_type::HalfedgeHandle heh = mesh.halfedge_handle(edge_to_collapse[i].handle, 0);
-            mesh_type::VertexHandle vh_from = mesh.from_vertex_handle(heh);
-            mesh_type::VertexHandle vh_to = mesh.to_vertex_handle(heh);
-
-            bool can_collapse = mesh.is_collapse_ok(heh) && !mesh.is_boundary(vh_from) && !mesh.is_boundary(vh_to);
-            if (can_collapse) {
-                for (mesh_type::VertexOHalfedgeIter voh_it(mesh, vh_from); voh_it.is_valid(); ++voh_it) {
-                    if (edge_weight(mesh.edge_handle(*voh_it)) >= target_weight_hi) {
-                        can_collapse = false;
-                        break;
-                    }
+        std::vector<weighted_edge> edge_to_collapse = select_edges([target_weight_lo](float weight) { return weight < target_weight_lo; });
+        std::vector<EdgeHandle> batch;
+        std::vector<weighted_edge> deferred;
+
+        while (!edge_to_collapse.empty()) {
+            select_batch(edge_to_collapse.size(), [this, &edge_to_collapse](size_t i, std::vector<VertexHandle> &vertices) {
+                return collapse_region(edge_to_collapse[i].handle, vertices);
+            });
+            batch.clear();
+            deferred.clear();
+            for (size_t i = 0; i < edge_to_collapse.size(); ++i) {
+                if (batch_state[i] == op_selected) {
+                    batch.push_back(edge_to_collapse[i].handle);
+                }
+                else if (batch_state[i] == op_deferred) {
+                    deferred.push_back(edge_to_collapse[i]);
                 }
             }
 
-            if (can_collapse) {
-                mesh.property(valence_ph, mesh.opposite_vh(heh))--;
-                mesh.property(valence_ph, mesh.opposite_vh(mesh.opposite_halfedge_handle(heh)))--;
-                mesh.collapse(heh);
-                mesh.property(valence_ph, vh_to) = mesh.valence(vh_to);
+            std::atomic<size_t> n_collapsed(0);
+            parallel_for(0, batch.size(), [this, &batch, &n_collapsed, target_weight_hi](size_t i) {
+                if (collapse_edge(batch[i], target_weight_hi)) {
+                    n_collapsed++;
+                }
+            }, 64);
+            deleted_vertices += n_collapsed;
+
+            // edges next to a collapse have moved, check them again
+            edge_to_collapse.clear();
+            for (size_t i = 0; i < deferred.size(); ++i) {
+                EdgeHandle eh = deferred[i].handle;
+                if (!mesh.status(eh).deleted()) {
+                    float weight = edge_weight(eh);
+                    if (weight < target_weight_lo) {
+                        edge_to_collapse.emplace_back(eh, weight);
+                    }
+                }
             }
         }
     }
 
+    bool collapse_edge(const EdgeHandle &eh, float target_weight_hi) {
+        HalfedgeHandle heh = mesh.halfedge_handle(eh, 0);
+        VertexHandle vh_from = mesh.from_vertex_handle(heh);
+        VertexHandle vh_to = mesh.to_vertex_handle(heh);
+
+        // crease vertices are locked, others may collapse onto them
+        bool can_collapse = mesh.is_collapse_ok(heh) && !mesh.is_boundary(vh_from) && !mesh.is_boundary(vh_to) && !mesh.status(vh_from).feature();
+        if (can_collapse) {
+            for_each_outgoing(vh_from, [this, target_weight_hi, &can_collapse](const HalfedgeHandle &h) {
+                if (edge_weight(mesh.edge_handle(h)) >= target_weight_hi) {
+                    can_collapse = false;
+                }
+            });
+        }
+        // vh_to takes over the edges of vh_from
+        if (can_collapse && lock_boundary && mesh.is_boundary(vh_to)) {
+            VertexHandle vh_left = mesh.opposite_vh(heh);
+            VertexHandle vh_right = mesh.opposite_vh(mesh.opposite_halfedge_handle(heh));
+            for_each_outgoing(vh_from, [this, vh_to, vh_left, vh_right, &can_collapse](const HalfedgeHandle &h) {
+                VertexHandle vh = mesh.to_vertex_handle(h);
+                if (vh != vh_to && vh != vh_left && vh != vh_right && mesh.is_boundary(vh)) {
+                    can_collapse = false;
+                }
+            });
+        }
+        // the faces kept around vh_from are rewired to the position of vh_to
+        if (can_collapse) {
+            const Point &pt_from = mesh.point(vh_from);
+            const Point &pt_to = mesh.point(vh_to);
+            for_each_outgoing(vh_from, [this, vh_to, &pt_from, &pt_to, &can_collapse](const HalfedgeHandle &h) {
+                if (!mesh.face_handle(h).is_valid()) return;
+                VertexHandle vh1 = mesh.to_vertex_handle(h);
+                VertexHandle vh2 = mesh.to_vertex_handle(mesh.next_halfedge_handle(h));
+                if (vh1 == vh_to || vh2 == vh_to) return;
+                const Point &pt1 = mesh.point(vh1);
+                const Point &pt2 = mesh.point(vh2);
+                if (!is_face_ok(pt_to, pt1, pt2, cross(pt1 - pt_from, pt2 - pt_from))) {
+                    can_collapse = false;
+                }
+            });
+        }
+
+        if (can_collapse) {
+            mesh.property(valence_ph, mesh.opposite_vh(heh))--;
+            mesh.property(valence_ph, mesh.opposite_vh(mesh.opposite_halfedge_handle(heh)))--;
+            mesh.collapse(heh);
+            mesh.property(valence_ph, vh_to) = mesh.valence(vh_to);
+            mesh.property(touched_ph, vh_to) = 1;
+        }
+        return can_collapse;
+    }
+
     void adjust_valence() {
-        for (mesh_type::EdgeIter e_it = mesh.edges_sbegin(); e_it != mesh.edges_end(); ++e_it) {
-            if (!mesh.is_flip_ok(*e_it) || mesh.is_boundary(*e_it)) continue;
+        std::vector<EdgeHandle> edge_to_flip;
+        for (size_t i = 0; i < mesh.n_edges(); ++i) {
+            EdgeHandle eh((int)i);
+            if (!mesh.status(eh).deleted()) {
+                edge_to_flip.push_back(eh);
+            }
+        }
+        std::vector<EdgeHandle> batch;
+        std::vector<EdgeHandle> deferred;
+
+        while (!edge_to_flip.empty()) {
+            select_batch(edge_to_flip.size(), [this, &edge_to_flip](size_t i, std::vector<VertexHandle> &vertices) {
+                return flip_region(edge_to_flip[i], vertices);
+            });
+            batch.clear();
+            deferred.clear();
+            for (size_t i = 0; i < edge_to_flip.size(); ++i) {
+                if (batch_state[i] == op_selected) {
+                    batch.push_back(edge_to_flip[i]);
+                }
+                else if (batch_state[i] == op_deferred) {
+                    deferred.push_back(edge_to_flip[i]);
+                }
+            }
 
-            /*
-                     a1
-                     +
-                   /   \
-                 /       \
-            a2 +---------->+ a0
-                 \  heh  /
-                   \   /
-                     +
-                     a3
-            */
+            parallel_for(0, batch.size(), [this, &batch](size_t i) {
+                flip_edge(batch[i]);
+            }, 256);
 
-            mesh_type::HalfedgeHandle heh = mesh.halfedge_handle(*e_it, 0);
-            mesh_type::VertexHandle a0 = mesh.to_vertex_handle(heh);
-            mesh_type::VertexHandle a1 = mesh.opposite_vh(heh);
-            mesh_type::VertexHandle a2 = mesh.from_vertex_handle(heh);
-            mesh_type::VertexHandle a3 = mesh.opposite_vh(mesh.opposite_halfedge_handle(heh));
+            // valences around the flipped edges have changed, evaluate them again
+            edge_to_flip.swap(deferred);
+        }
+    }
 
-            int diff_a0 = valence(a0) - target_valence(a0);
-            int diff_a1 = valence(a1) - target_valence(a1);
-            int diff_a2 = valence(a2) - target_valence(a2);
-            int diff_a3 = valence(a3) - target_valence(a3);
+    bool flip_improves_valence(const EdgeHandle &eh) const {
+        if (mesh.status(eh).deleted() || mesh.status(eh).feature() || mesh.is_boundary(eh) || !mesh.is_flip_ok(eh)) return false;
+
+        /*
+                 a1
+                 +
+               /   \
+             /       \
+        a2 +---------->+ a0
+             \  heh  /
+               \   /
+                 +
+                 a3
+        */
+
+        HalfedgeHandle heh = mesh.halfedge_handle(eh, 0);
+        VertexHandle a0 = mesh.to_vertex_handle(heh);
+        VertexHandle a1 = mesh.opposite_vh(heh);
+        VertexHandle a2 = mesh.from_vertex_handle(heh);
+        VertexHandle a3 = mesh.opposite_vh(mesh.opposite_halfedge_handle(heh));
+
+        int diff_a0 = valence(a0) - target_valence(a0);
+        int diff_a1 = valence(a1) - target_valence(a1);
+        int diff_a2 = valence(a2) - target_valence(a2);
+        int diff_a3 = valence(a3) - target_valence(a3);
+
+        int dev_pre = abs(diff_a0) + abs(diff_a1) + abs(diff_a2) + abs(diff_a3);
+        int dev_post = abs(diff_a0 - 1) + abs(diff_a1 + 1) + abs(diff_a2 - 1) + abs(diff_a3 + 1);
+
+        return dev_post < dev_pre;
+    }
 
-            int dev_pre = abs(diff_a0) + abs(diff_a1) + abs(diff_a2) + abs(diff_a3);
-            int dev_post = abs(diff_a0 - 1) + abs(diff_a1 + 1) + abs(diff_a2 - 1) + abs(diff_a3 + 1);
+    // the two faces after the flip are not degenerate and face the same side as the two before
+    bool flip_keeps_faces(const EdgeHandle &eh) const {
+        HalfedgeHandle heh = mesh.halfedge_handle(eh, 0);
+        const Point &p0 = mesh.point(mesh.to_vertex_handle(heh));
+        const Point &p1 = mesh.point(mesh.opposite_vh(heh));
+        const Point &p2 = mesh.point(mesh.from_vertex_handle(heh));
+        const Point &p3 = mesh.point(mesh.opposite_vh(mesh.opposite_halfedge_handle(heh)));
+        Point normal = cross(p0 - p2, p1 - p2) + cross(p2 - p0, p3 - p0);
+        return is_face_ok(p0, p1, p3, normal) && is_face_ok(p1, p2, p3, normal);
+    }
 
-            if (dev_post < dev_pre) {
-                mesh.flip(*e_it);
-                mesh.property(valence_ph, a0)--;
-                mesh.property(valence_ph, a1)++;
-                mesh.property(valence_ph, a2)--;
-                mesh.property(valence_ph, a3)++;
+    void flip_edge(const EdgeHandle &eh) {
+        HalfedgeHandle heh = mesh.halfedge_handle(eh, 0);
+        VertexHandle a0 = mesh.to_vertex_handle(heh);
+        VertexHandle a1 = mesh.opposite_vh(heh);
+        VertexHandle a2 = mesh.from_vertex_handle(heh);
+        VertexHandle a3 = mesh.opposite_vh(mesh.opposite_halfedge_handle(heh));
+
+        mesh.flip(eh);
+        mesh.property(valence_ph, a0)--;
+        mesh.property(valence_ph, a1)++;
+        mesh.property(valence_ph, a2)--;
+        mesh.property(valence_ph, a3)++;
+        mesh.property(touched_ph, a1) = 1;
+    }
+
+    // weights of all live edges are evaluated in parallel, selection keeps the edge order
+    template <typename Pred>
+    std::vector<weighted_edge> select_edges(Pred pred) const {
+        size_t n_edges = mesh.n_edges();
+        std::vector<float> weights(n_edges);
+        std::vector<unsigned char> selected(n_edges, 0);
+        parallel_for(0, n_edges, [this, &pred, &weights, &selected](size_t i) {
+            EdgeHandle eh((int)i);
+            if (!mesh.status(eh).deleted()) {
+                weights[i] = edge_weight(eh);
+                selected[i] = pred(weights[i]);
+            }
+        });
+
+        std::vector<weighted_edge> result;
+        for (size_t i = 0; i < n_edges; ++i) {
+            if (selected[i]) {
+                result.emplace_back(EdgeHandle((int)i), weights[i]);
             }
         }
+        return result;
+    }
+
+    /*
+        Long edges around the vertices touched since the last split phase, which left no long edge behind.
+        An edge between two touched vertices is found from the one with the smaller index.
+    */
+    std::vector<weighted_edge> select_touched_edges(float target_weight) {
+        std::vector<std::vector<weighted_edge>> found(parallel_thread_count());
+        parallel_for_chunks(0, mesh.n_vertices(), [this, target_weight, &found](size_t lo, size_t hi, size_t t) {
+            for (size_t i = lo; i < hi; ++i) {
+                VertexHandle vh((int)i);
+                if (!mesh.property(touched_ph, vh) || mesh.status(vh).deleted()) continue;
+                for_each_outgoing(vh, [this, &vh, target_weight, &found, t](const HalfedgeHandle &h) {
+                    VertexHandle vh_to = mesh.to_vertex_handle(h);
+                    if (mesh.property(touched_ph, vh_to) && vh_to.idx() < vh.idx()) return;
+                    EdgeHandle eh = mesh.edge_handle(h);
+                    float weight = edge_weight(eh);
+                    if (weight > target_weight) {
+                        found[t].emplace_back(eh, weight);
+                    }
+                });
+            }
+        });
+        parallel_for(0, mesh.n_vertices(), [this](size_t i) {
+            mesh.property(touched_ph, VertexHandle((int)i)) = 0;
+        });
+
+        std::vector<weighted_edge> result;
+        for (size_t t = 0; t < found.size(); ++t) {
+            result.insert(result.end(), found[t].begin(), found[t].end());
+        }
+        return result;
+    }
+
+    // vertices a collapse of eh rewires, false when eh cannot collapse
+    bool collapse_region(const EdgeHandle &eh, std::vector<VertexHandle> &vertices) const {
+        if (mesh.status(eh).deleted()) return false;
+        HalfedgeHandle heh = mesh.halfedge_handle(eh, 0);
+        VertexHandle vh_from = mesh.from_vertex_handle(heh);
+        VertexHandle vh_to = mesh.to_vertex_handle(heh);
+        if (mesh.is_boundary(vh_from) || mesh.is_boundary(vh_to) || mesh.status(vh_from).feature()) return false;
+
+        // a collapse rewires faces around both end points
+        vertices.clear();
+        vertices.push_back(vh_from);
+        vertices.push_back(vh_to);
+        for_each_outgoing(vh_from, [this, &vertices](const HalfedgeHandle &h) {
+            vertices.push_back(mesh.to_vertex_handle(h));
+        });
+        for_each_outgoing(vh_to, [this, &vertices](const HalfedgeHandle &h) {
+            vertices.push_back(mesh.to_vertex_handle(h));
+        });
+        return true;
+    }
+
+    // vertices a flip of eh rewires, false when the flip does not improve the valences
+    bool flip_region(const EdgeHandle &eh, std::vector<VertexHandle> &vertices) const {
+        if (!flip_improves_valence(eh) || !flip_keeps_faces(eh)) return false;
+
+        // a flip rewires the two faces of the edge
+        HalfedgeHandle heh = mesh.halfedge_handle(eh, 0);
+        if (lock_boundary && mesh.is_boundary(mesh.opposite_vh(heh)) && mesh.is_boundary(mesh.opposite_vh(mesh.opposite_halfedge_handle(heh)))) return false;
+        vertices.clear();
+        vertices.push_back(mesh.to_vertex_handle(heh));
+        vertices.push_back(mesh.opposite_vh(heh));
+        vertices.push_back(mesh.from_vertex_handle(heh));
+        vertices.push_back(mesh.opposite_vh(mesh.opposite_halfedge_handle(heh)));
+        return true;
+    }
+
+    enum op_state { op_dropped, op_selected, op_deferred };
+
+    // distinct per index, hash in the high bits
+    static unsigned long long batch_priority(size_t i) {
+        unsigned int h = (unsigned int)i;
+        h ^= h >> 16;
+        h *= 0x7feb352du;
+        h ^= h >> 15;
+        h *= 0x846ca68bu;
+        h ^= h >> 16;
+        return ((unsigned long long)h << 32) | (unsigned int)i;
+    }
+
+    /*
+        Splits n candidate operations into a batch whose regions share no vertex and the deferred rest,
+        batch_state[i] tells which. region(i, vertices) lists the vertices operation i rewires, or returns false to drop it.
+        Every candidate writes the minimum of its priority into its vertices and joins the batch when it holds all of them.
+        Priorities are hashed indices, neighbouring edges are usually adjacent in the list and index order
+        would let only one edge of a long chain in per batch. The result does not depend on the thread count,
+        and the live candidate of lowest priority always joins.
+    */
+    template <typename Region>
+    void select_batch(size_t n, Region region) {
+        const unsigned long long unowned = std::numeric_limits<unsigned long long>::max();
+        if (region_owner.size() < mesh.n_vertices()) {
+            region_owner = std::vector<std::atomic<unsigned long long>>(mesh.n_vertices());
+            parallel_for(0, region_owner.size(), [this, unowned](size_t i) {
+                region_owner[i].store(unowned, std::memory_order_relaxed);
+            });
+        }
+
+        // flatten the regions
+        batch_state.assign(n, op_dropped);
+        region_offsets.assign(n + 1, 0);
+        parallel_for_chunks(0, n, [this, &region](size_t lo, size_t hi, size_t) {
+            std::vector<VertexHandle> vertices;
+            for (size_t i = lo; i < hi; ++i) {
+                if (region(i, vertices)) {
+                    batch_state[i] = op_deferred;
+                    region_offsets[i + 1] = (int)vertices.size();
+                }
+            }
+        }, 256);
+        for (size_t i = 0; i < n; ++i) {
+            region_offsets[i + 1] += region_offsets[i];
+        }
+        region_vertices.resize(region_offsets[n]);
+        parallel_for_chunks(0, n, [this, &region](size_t lo, size_t hi, size_t) {
+            std::vector<VertexHandle> vertices;
+            for (size_t i = lo; i < hi; ++i) {
+                if (batch_state[i] != op_dropped) {
+                    region(i, vertices);
+                    std::copy(vertices.begin(), vertices.end(), region_vertices.begin() + region_offsets[i]);
+                }
+            }
+        }, 256);
+
+        // claim, check, then release the claimed vertices for the next batch
+        parallel_for(0, n, [this](size_t i) {
+            unsigned long long priority = batch_priority(i);
+            for (int k = region_offsets[i]; k < region_offsets[i + 1]; ++k) {
+                std::atomic<unsigned long long> &owner = region_owner[region_vertices[k].idx()];
+                unsigned long long current = owner.load(std::memory_order_relaxed);
+                while (priority < current && !owner.compare_exchange_weak(current, priority, std::memory_order_relaxed)) {}
+            }
+        }, 256);
+        parallel_for(0, n, [this](size_t i) {
+            unsigned long long priority = batch_priority(i);
+            bool owns_all = batch_state[i] != op_dropped;
+            for (int k = region_offsets[i]; owns_all && k < region_offsets[i + 1]; ++k) {
+                owns_all = region_owner[region_vertices[k].idx()].load(std::memory_order_relaxed) == priority;
+            }
+            if (owns_all) {
+                batch_state[i] = op_selected;
+            }
+        }, 256);
+        parallel_for(0, region_vertices.size(), [this, unowned](size_t k) {
+            region_owner[region_vertices[k].idx()].store(unowned, std::memory_order_relaxed);
+        });
     }
 
     void smooth(size_t max_iter, float lambda, bool tangential) {
+        build_rings();
+
+        size_t n_vertices = mesh.n_vertices();
+        smooth_points.resize(n_vertices);
+        smooth_npoints.resize(n_vertices);
+        parallel_for(0, n_vertices, [this](size_t i) {
+            smooth_points[i] = mesh.point(VertexHandle((int)i));
+        });
+
         for (size_t n_iter = 0; n_iter < max_iter; ++n_iter) {
-            for (mesh_type::VertexIter v_it = mesh.vertices_sbegin(); v_it != mesh.vertices_end(); ++v_it) {
-                mesh_type::Point opoint = mesh.point(*v_it);
-                if (mesh.is_boundary(*v_it)) {
-                    mesh.property(npoint_ph, *v_it) = opoint;
-                }
-                else {
-                    mesh_type::Point npoint(0.0f, 0.0f, 0.0f);
-                    for (mesh_type::VertexVertexIter vv_it = mesh.vv_begin(*v_it); vv_it != mesh.vv_end(*v_it); ++vv_it) {
-                        npoint += mesh.point(*vv_it);
-                    }
-                    npoint /= (float)valence(*v_it);
-                    mesh_type::Point shift = npoint - opoint;
-                    mesh_type::Point normal = mesh.normal(*v_it);
-                    if (tangential) {
-                        shift -= normal*dot(normal, shift);
-                    }
-                    mesh.property(npoint_ph, *v_it) = opoint + lambda*shift;
+            parallel_for(0, n_vertices, [this, lambda, tangential](size_t i) {
+                const Point &opoint = smooth_points[i];
+                int begin = ring_offsets[i];
+                int end = ring_offsets[i + 1];
+                if (begin == end) {
+                    // boundary, feature, deleted or isolated vertex
+                    smooth_npoints[i] = opoint;
+                    return;
+                }
+                Point npoint(0.0f, 0.0f, 0.0f);
+                for (int k = begin; k < end; ++k) {
+                    npoint += smooth_points[ring_vertices[k]];
+                }
+                npoint /= (float)(end - begin);
+                Point shift = npoint - opoint;
+                if (tangential) {
+                    Point normal = ring_normal(i, smooth_points);
+                    shift -= normal*dot(normal, shift);
                 }
+                smooth_npoints[i] = opoint + lambda*shift;
+            });
+            smooth_points.swap(smooth_npoints);
+        }
+
+        parallel_for(0, n_vertices, [this](size_t i) {
+            if (ring_offsets[i] != ring_offsets[i + 1]) {
+                VertexHandle vh((int)i);
+                touch_point(vh, smooth_points[i]);
+                mesh.set_normal(vh, ring_normal(i, smooth_points));
             }
-            for (mesh_type::VertexIter v_it = mesh.vertices_sbegin(); v_it != mesh.vertices_end(); ++v_it) {
-                mesh.set_point(*v_it, mesh.property(npoint_ph, *v_it));
+        });
+    }
+
+    // flattens the one-ring of every interior vertex in ccw order, boundary and feature vertices get empty rings
+    void build_rings() {
+        size_t n_vertices = mesh.n_vertices();
+        ring_offsets.assign(n_vertices + 1, 0);
+        parallel_for(0, n_vertices, [this](size_t i) {
+            VertexHandle vh((int)i);
+            if (mesh.status(vh).deleted() || mesh.status(vh).feature() || mesh.is_isolated(vh) || mesh.is_boundary(vh)) return;
+            int count = 0;
+            for_each_outgoing(vh, [&count](const HalfedgeHandle &) {
+                count++;
+            });
+            ring_offsets[i + 1] = count;
+        });
+        for (size_t i = 0; i < n_vertices; ++i) {
+            ring_offsets[i + 1] += ring_offsets[i];
+        }
+        ring_vertices.resize(ring_offsets[n_vertices]);
+        parallel_for(0, n_vertices, [this](size_t i) {
+            if (ring_offsets[i] == ring_offsets[i + 1]) return;
+            int k = ring_offsets[i];
+            for_each_outgoing(VertexHandle((int)i), [this, &k](const HalfedgeHandle &h) {
+                ring_vertices[k++] = mesh.to_vertex_handle(h).idx();
+            });
+        });
+    }
+
+    // moves the vertices smoothed last back onto the input surface
+    void project() {
+        if (reference.empty()) return;
+        parallel_for(0, mesh.n_vertices(), [this](size_t i) {
+            if (ring_offsets[i] == ring_offsets[i + 1]) return;
+            VertexHandle vh((int)i);
+            const Point &p = mesh.point(vh);
+            TriangleBVH::point_type closest;
+            if (reference.closest_point(TriangleBVH::point_type{ { p[0], p[1], p[2] } }, closest) >= 0) {
+                touch_point(vh, Point(closest[0], closest[1], closest[2]));
             }
+        }, 256);
+    }
+
+    // moves a vertex, marking it for the next split phase if it has moved at all
+    void touch_point(const VertexHandle &vh, const Point &p) {
+        const Point &q = mesh.point(vh);
+        if (p[0] != q[0] || p[1] != q[1] || p[2] != q[2]) {
+            mesh.set_point(vh, p);
+            mesh.property(touched_ph, vh) = 1;
         }
     }
 
+    // area weighted normal of an interior vertex from the current positions
+    Point ring_normal(size_t i, const std::vector<Point> &points) const {
+        const Point &p = points[i];
+        int begin = ring_offsets[i];
+        int end = ring_offsets[i + 1];
+        Point normal(0.0f, 0.0f, 0.0f);
+        for (int k = begin; k < end; ++k) {
+            int k_next = (k + 1 < end) ? k + 1 : begin;
+            normal += cross(points[ring_vertices[k]] - p, points[ring_vertices[k_next]] - p);
+        }
+        float len = normal.norm();
+        if (len > 0.0f) {
+            normal /= len;
+        }
+        return normal;
+    }
+
+    // calls f on the outgoing halfedges of vh in ccw order
+    template <typename F>
+    void for_each_outgoing(const VertexHandle &vh, F f) const {
+        HalfedgeHandle heh0 = mesh.halfedge_handle(vh);
+        if (!heh0.is_valid()) return;
+        HalfedgeHandle heh = heh0;
+        do {
+            f(heh);
+            heh = mesh.opposite_halfedge_handle(mesh.prev_halfedge_handle(heh));
+        } while (heh != heh0);
+    }
+
     bool test_manifold() {
-        for (mesh_type::VertexIter v_it = mesh.vertices_begin(); v_it != mesh.vertices_end(); ++v_it) {
-            if (!mesh.is_manifold(*v_it)) {
+        for (size_t i = 0; i < mesh.n_vertices(); ++i) {
+            if (!mesh.is_manifold(VertexHandle((int)i))) {
                 return false;
             }
         }
@@ -213,8 +758,9 @@ private:
 
     void prepare_valence() {
         mesh.add_property(valence_ph);
-        for (mesh_type::VertexIter v_it = mesh.vertices_begin(); v_it != mesh.vertices_end(); ++v_it) {
-            mesh.property(valence_ph, *v_it) = mesh.valence(*v_it);
+        for (size_t i = 0; i < mesh.n_vertices(); ++i) {
+            VertexHandle vh((int)i);
+            mesh.property(valence_ph, vh) = mesh.valence(vh);
         }
     }
 
@@ -224,30 +770,160 @@ private:
         mesh.update_normals();
     }
 
+    void prepare_sizing() {
+        mesh.add_property(sizing_ph);
+    }
+
+    void prepare_touched() {
+        mesh.add_property(touched_ph);
+    }
+
+    void prepare_curvature_sizing(float min_edge_len, float max_edge_len, float max_error) {
+        mesh.update_normals();
+        parallel_for(0, mesh.n_vertices(), [this, min_edge_len, max_edge_len, max_error](size_t i) {
+            VertexHandle vh((int)i);
+            if (mesh.status(vh).deleted()) return;
+            // largest normal curvature along the edges, 2*n.(p-q)/|p-q|^2
+            const Point &p = mesh.point(vh);
+            const Normal &n = mesh.normal(vh);
+            float k = 0.0f;
+            for_each_outgoing(vh, [this, &p, &n, &k](const HalfedgeHandle &h) {
+                Point d = p - mesh.point(mesh.to_vertex_handle(h));
+                float sqrlen = d.sqrnorm();
+                if (sqrlen > 0.0f) {
+                    k = std::max(k, std::abs(2.0f*dot(n, d) / sqrlen));
+                }
+            });
+            float len = max_edge_len;
+            float sqrlen = 6.0f*max_error / k - 3.0f*max_error*max_error;
+            if (k > 0.0f && sqrlen < len*len) {
+                len = sqrt(std::max(sqrlen, 0.0f));
+            }
+            mesh.property(sizing_ph, vh) = std::max(min_edge_len, std::min(max_edge_len, len));
+        });
+    }
+
+    // copies the current surface into the BVH used by project()
+    void prepare_reference() {
+        reference = TriangleBVH();
+        if (!project_to_surface) return;
+        std::vector<TriangleBVH::point_type> points(mesh.n_vertices());
+        for (size_t i = 0; i < points.size(); ++i) {
+            const Point &p = mesh.point(VertexHandle((int)i));
+            points[i] = TriangleBVH::point_type{ { p[0], p[1], p[2] } };
+        }
+        std::vector<TriangleBVH::triangle_type> triangles;
+        triangles.reserve(mesh.n_faces());
+        for (size_t i = 0; i < mesh.n_faces(); ++i) {
+            FaceHandle fh((int)i);
+            if (mesh.status(fh).deleted()) continue;
+            HalfedgeHandle heh = mesh.halfedge_handle(fh);
+            TriangleBVH::triangle_type triangle;
+            for (int k = 0; k < 3; ++k) {
+                triangle[k] = mesh.to_vertex_handle(heh).idx();
+                heh = mesh.next_halfedge_handle(heh);
+            }
+            triangles.push_back(triangle);
+        }
+        reference.build(points, triangles);
+    }
+
+    // marks creases by dihedral angle, and every vertex on a crease
+    void prepare_features() {
+        mesh.update_face_normals();
+        if (feature_angle > 0.0f) {
+            float cos_angle = cos(feature_angle*float(M_PI) / 180.0f);
+            parallel_for(0, mesh.n_edges(), [this, cos_angle](size_t i) {
+                EdgeHandle eh((int)i);
+                if (mesh.status(eh).deleted() || mesh.is_boundary(eh)) return;
+                FaceHandle fh0 = mesh.face_handle(mesh.halfedge_handle(eh, 0));
+                FaceHandle fh1 = mesh.face_handle(mesh.halfedge_handle(eh, 1));
+                if (dot(mesh.normal(fh0), mesh.normal(fh1)) < cos_angle) {
+                    mesh.status(eh).set_feature(true);
+                }
+            });
+        }
+        for (size_t i = 0; i < mesh.n_edges(); ++i) {
+            EdgeHandle eh((int)i);
+            if (!mesh.status(eh).deleted() && mesh.status(eh).feature()) {
+                HalfedgeHandle heh = mesh.halfedge_handle(eh, 0);
+                mesh.status(mesh.from_vertex_handle(heh)).set_feature(true);
+                mesh.status(mesh.to_vertex_handle(heh)).set_feature(true);
+            }
+        }
+    }
+
     void prepare_status() {
         mesh.request_vertex_status();
         mesh.request_edge_status();
         mesh.request_face_status();
     }
 
+    void collect_garbage() {
+        if (deleted_vertices > 0 && deleted_vertices >= gc_threshold*mesh.n_vertices()) {
+            force_gc();
+        }
+    }
+
     void force_gc() {
         mesh.garbage_collection();
+        deleted_vertices = 0;
     }
 
-    int valence(const mesh_type::VertexHandle &vh) const {
+    template <typename F>
+    void timed(double &seconds, F f) {
+        auto timer = make_timer<std::chrono::duration<double>>([&seconds](double t) {
+            seconds += t;
+        });
+        f();
+    }
+
+    int valence(const VertexHandle &vh) const {
         return mesh.property(valence_ph, vh);
     }
 
-    int target_valence(const mesh_type::VertexHandle &vh) const {
+    int target_valence(const VertexHandle &vh) const {
         return mesh.is_boundary(vh) ? 4 : 6;
     }
 
-    float edge_weight(const mesh_type::EdgeHandle &eh) const {
-        return mesh.calc_edge_sqr_length(eh);
+    // face (a, b, c) is not degenerate and its normal is less than 90 degrees from normal
+    static bool is_face_ok(const Point &a, const Point &b, const Point &c, const Point &normal) {
+        Point n = cross(b - a, c - a);
+        float longest = std::max((b - a).sqrnorm(), std::max((c - b).sqrnorm(), (a - c).sqrnorm()));
+        return n.norm() > face_area_min*longest && dot(n, normal) > 0.0f;
+    }
+
+    float edge_weight(const EdgeHandle &eh) const {
+        HalfedgeHandle heh = mesh.halfedge_handle(eh, 0);
+        float len = 0.5f*(mesh.property(sizing_ph, mesh.from_vertex_handle(heh)) + mesh.property(sizing_ph, mesh.to_vertex_handle(heh)));
+        return mesh.calc_edge_sqr_length(eh) / (len*len);
     }
 
     mesh_type &mesh;
-    OpenMesh::VPropHandleT<int> valence_ph;
-    OpenMesh::VPropHandleT<mesh_type::Point> npoint_ph;
-    OpenMesh::VPropHandleT<float> weight_ph;
-};
\ No newline at end of file
+    vertex_property<int> valence_ph;
+    vertex_property<float> sizing_ph;
+    vertex_property<unsigned char> touched_ph;
+
+    std::vector<unsigned int> edge_stamps;
+
+    std::vector<unsigned char> batch_state;
+    std::vector<int> region_offsets;
+    std::vector<VertexHandle> region_vertices;
+    std::vector<std::atomic<unsigned long long>> region_owner;
+
+    std::vector<int> ring_offsets;
+    std::vector<int> ring_vertices;
+    std::vector<Point> smooth_points;
+    std::vector<Point> smooth_npoints;
+
+    TriangleBVH reference;
+    float feature_angle = 0.0f;
+    bool project_to_surface = true;
+    bool lock_boundary = false;
+
+    float gc_threshold = 0.2f;
+    size_t deleted_vertices = 0;
+    phase_timings timings;
+};
+
+typedef basic_remesher<halfedge_mesh> remesher_compact;
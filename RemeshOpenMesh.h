@@ -0,0 +1,49 @@
+#pragma once
+
+/*
+    basic_remesher on OpenMesh, written and tested with OpenMesh 3.2.
+    Kept out of Remesh.h so that remesher_compact builds without OpenMesh.
+*/
+
+#include <OpenMesh/Core/IO/MeshIO.hh>
+#include <OpenMesh/Core/Mesh/TriMesh_ArrayKernelT.hh>
+#include "Remesh.h"
+
+template <typename Traits, typename T>
+struct remesher_vertex_property<OpenMesh::TriMesh_ArrayKernelT<Traits>, T> {
+    typedef OpenMesh::VPropHandleT<T> type;
+};
+
+typedef basic_remesher<OpenMesh::TriMesh_ArrayKernelT<>> remesher;
+
+/*
+#include <cstdlib>
+#include <iostream>
+#include "RemeshOpenMesh.h"
+
+// remeshes the same input with both kernels
+int main(int argc, char *argv[]) {
+    remesher::mesh_type om_mesh;
+    OpenMesh::IO::read_mesh(om_mesh, argv[1]);
+    halfedge_mesh he_mesh;
+    import_mesh(he_mesh, om_mesh);
+    float target_edge_len = (float)atof(argv[2]);
+
+    {
+        auto timer = make_timer([](double t) { std::cout << "OpenMesh:      " << t << "s" << std::endl; });
+        remesher r(om_mesh);
+        r.remesh(target_edge_len, 10);
+    }
+    {
+        auto timer = make_timer([](double t) { std::cout << "halfedge_mesh: " << t << "s" << std::endl; });
+        remesher_compact r(he_mesh);
+        r.remesh(target_edge_len, 10);
+    }
+    std::cout << om_mesh.n_faces() << " / " << he_mesh.n_faces() << " faces" << std::endl;
+
+    remesher::mesh_type result;
+    export_mesh(he_mesh, result);
+    OpenMesh::IO::write_mesh(result, "remeshed.obj");
+    return 0;
+}
+*/
@@ -0,0 +1,357 @@
+#pragma once
+
+/*
+    Out-of-core remeshing for PLY meshes that do not fit in memory.
+
+    The input is partitioned into cubic chunks by face centroid, chunk files go to a temporary directory.
+    Vertex positions are looked up from a paged file through an LRU cache while faces are partitioned,
+    so peak memory is bounded by the chunk size, the cache size and the number of seam vertices.
+
+    Each chunk is remeshed on its own with remesher_compact. Seams between chunks are chunk boundaries,
+    which every pass locks: seam vertices are never moved or collapsed, no new edge joins two of them, and seam edges
+    only change by midpoint splits of identical edges, so both sides of a seam produce the same vertices.
+    Refusing those splits would not terminate next to seam edges longer than the target.
+    The output is stitched by welding boundary vertices by original vertex id, or by exact position for split vertices.
+    A closed manifold input gives a closed manifold output.
+    Further passes shift the chunk grid, so the seams of one pass are remeshed inside the chunks of the next.
+*/
+
+#include <set>
+#include <map>
+#include <array>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cfloat>
+#include <cstdint>
+#include <fstream>
+#include <algorithm>
+#include <unordered_map>
+#include "LRU.h"
+#include "PlyStream.h"
+#include "Remesh.h"
+
+class streaming_remesher {
+public:
+    streaming_remesher(const std::string &temp_dir) : temp_dir(temp_dir) {}
+
+    float get_chunk_size() const {
+        return chunk_size;
+    }
+
+    // edge length of the cubic chunks, in model units
+    void set_chunk_size(float size) {
+        chunk_size = size;
+    }
+
+    size_t get_cache_pages() const {
+        return cache_pages;
+    }
+
+    // vertex pages of 4096 positions kept in memory while partitioning
+    void set_cache_pages(size_t pages) {
+        cache_pages = pages;
+    }
+
+    size_t get_passes() const {
+        return passes;
+    }
+
+    // each pass shifts the chunk grid by chunk_size/passes
+    void set_passes(size_t n) {
+        passes = n;
+    }
+
+    bool remesh(const std::string &input, const std::string &output, float target_edge_len, size_t max_iter) {
+        std::string source = input;
+        for (size_t pass = 0; pass < passes; ++pass) {
+            std::string target = (pass + 1 == passes) ? output : temp_path("pass" + std::to_string(pass) + ".ply");
+            bool ok = remesh_pass(source, target, chunk_size*pass / passes, target_edge_len, max_iter);
+            if (source != input) {
+                std::remove(source.c_str());
+            }
+            if (!ok) return false;
+            source = target;
+        }
+        return true;
+    }
+
+private:
+    static const size_t page_bits = 12;
+    static const size_t flush_records = 4096;
+
+    // a triangle with its original vertex ids and positions
+    struct face_record {
+        std::uint32_t ids[3];
+        float points[3][3];
+    };
+
+    bool remesh_pass(const std::string &input, const std::string &output, float shift, float target_edge_len, size_t max_iter) {
+        std::map<std::int64_t, size_t> chunks;
+        if (!partition(input, shift, chunks)) return false;
+
+        ply_writer writer;
+        if (!writer.open(output)) return false;
+        seam_ids.clear();
+        seam_points.clear();
+        for (std::map<std::int64_t, size_t>::iterator it = chunks.begin(); it != chunks.end(); ++it) {
+            remesh_chunk(it->first, writer, target_edge_len, max_iter);
+            std::remove(chunk_path(it->first).c_str());
+        }
+        return writer.close();
+    }
+
+    // writes the faces of every chunk to its own file, chunks receives the face count of each
+    bool partition(const std::string &input, float shift, std::map<std::int64_t, size_t> &chunks) {
+        ply_reader reader;
+        if (!reader.open(input)) return false;
+
+        // vertex positions go to a paged file
+        std::string vertex_path = temp_path("vertices.bin");
+        size_t n_vertices = reader.vertex_count();
+        float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+        float hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        {
+            std::ofstream vertex_file(vertex_path, std::ios::binary);
+            float p[3];
+            for (size_t i = 0; i < n_vertices; ++i) {
+                if (!reader.read_vertex(p)) return false;
+                vertex_file.write((const char *)p, sizeof(p));
+                for (int k = 0; k < 3; ++k) {
+                    lo[k] = std::min(lo[k], p[k]);
+                    hi[k] = std::max(hi[k], p[k]);
+                }
+            }
+            if (!vertex_file) return false;
+        }
+
+        std::int64_t dims[3];
+        for (int k = 0; k < 3; ++k) {
+            lo[k] -= shift;
+            dims[k] = (std::int64_t)((hi[k] - lo[k]) / chunk_size) + 1;
+        }
+
+        std::ifstream vertex_file(vertex_path, std::ios::binary);
+        LRU<size_t, std::vector<float>> pages(cache_pages);
+        pages.set_reader([&vertex_file, n_vertices](const size_t &page, std::vector<float> &points) {
+            size_t first = page << page_bits;
+            size_t count = std::min((size_t)1 << page_bits, n_vertices - first);
+            points.resize(3 * count);
+            vertex_file.clear();
+            vertex_file.seekg(first * 3 * sizeof(float));
+            vertex_file.read((char *)points.data(), points.size() * sizeof(float));
+        });
+
+        // chunk files left over from an earlier pass or run are truncated on their first flush
+        std::map<std::int64_t, std::vector<face_record>> buffers;
+        std::set<std::int64_t> flushed;
+        std::vector<int> polygon;
+        for (size_t f = 0; f < reader.face_count(); ++f) {
+            if (!reader.read_face(polygon)) return false;
+            // polygons are split into fans
+            for (size_t k = 2; k < polygon.size(); ++k) {
+                int ids[3] = { polygon[0], polygon[k - 1], polygon[k] };
+                if (ids[0] == ids[1] || ids[1] == ids[2] || ids[2] == ids[0]) continue;
+                face_record record;
+                float centroid[3] = { 0.0f, 0.0f, 0.0f };
+                bool valid = true;
+                for (int j = 0; j < 3; ++j) {
+                    if (ids[j] < 0 || (size_t)ids[j] >= n_vertices) {
+                        valid = false;
+                        break;
+                    }
+                    record.ids[j] = (std::uint32_t)ids[j];
+                    const std::vector<float> &page = pages.get((size_t)ids[j] >> page_bits);
+                    size_t offset = 3 * ((size_t)ids[j] & (((size_t)1 << page_bits) - 1));
+                    for (int d = 0; d < 3; ++d) {
+                        record.points[j][d] = page[offset + d];
+                        centroid[d] += page[offset + d] / 3.0f;
+                    }
+                }
+                if (!valid) continue;
+
+                std::int64_t cell[3];
+                for (int d = 0; d < 3; ++d) {
+                    cell[d] = std::max((std::int64_t)0, std::min(dims[d] - 1, (std::int64_t)((centroid[d] - lo[d]) / chunk_size)));
+                }
+                std::int64_t chunk = (cell[0] * dims[1] + cell[1]) * dims[2] + cell[2];
+                std::vector<face_record> &buffer = buffers[chunk];
+                buffer.push_back(record);
+                chunks[chunk]++;
+                if (buffer.size() >= flush_records) {
+                    flush_chunk(chunk, buffer, !flushed.insert(chunk).second);
+                }
+            }
+        }
+        for (std::map<std::int64_t, std::vector<face_record>>::iterator it = buffers.begin(); it != buffers.end(); ++it) {
+            flush_chunk(it->first, it->second, !flushed.insert(it->first).second);
+        }
+        vertex_file.close();
+        std::remove(vertex_path.c_str());
+        return true;
+    }
+
+    void flush_chunk(std::int64_t chunk, std::vector<face_record> &buffer, bool append) {
+        std::ofstream file(chunk_path(chunk), std::ios::binary | (append ? std::ios::app : std::ios::trunc));
+        file.write((const char *)buffer.data(), buffer.size() * sizeof(face_record));
+        buffer.clear();
+    }
+
+    void remesh_chunk(std::int64_t chunk, ply_writer &writer, float target_edge_len, size_t max_iter) {
+        std::vector<face_record> records;
+        {
+            std::ifstream file(chunk_path(chunk), std::ios::binary | std::ios::ate);
+            records.resize((size_t)file.tellg() / sizeof(face_record));
+            file.seekg(0);
+            file.read((char *)records.data(), records.size() * sizeof(face_record));
+        }
+
+        // weld the chunk by original vertex id
+        std::unordered_map<std::uint32_t, int> local;
+        std::vector<halfedge_mesh::Point> points;
+        std::vector<std::uint32_t> origin;
+        std::vector<int> triangles;
+        for (size_t i = 0; i < records.size(); ++i) {
+            for (int k = 0; k < 3; ++k) {
+                std::pair<std::unordered_map<std::uint32_t, int>::iterator, bool> it = local.emplace(records[i].ids[k], (int)points.size());
+                if (it.second) {
+                    const float *p = records[i].points[k];
+                    points.emplace_back(p[0], p[1], p[2]);
+                    origin.push_back(records[i].ids[k]);
+                }
+                triangles.push_back(it.first->second);
+            }
+        }
+
+        halfedge_mesh mesh;
+        std::vector<int> copies;
+        if (!mesh.build(points, triangles, &copies)) {
+            // non-manifold edges, the chunk is written as is
+            std::vector<std::uint32_t> global(points.size());
+            for (size_t i = 0; i < points.size(); ++i) {
+                global[i] = seam_vertex(points[i], origin[i] + 1, writer);
+            }
+            for (size_t i = 0; i < triangles.size(); i += 3) {
+                writer.write_face(global[triangles[i]], global[triangles[i + 1]], global[triangles[i + 2]]);
+            }
+            return;
+        }
+
+        // original id + 1 of every vertex, 0 for vertices created by the remesher
+        halfedge_mesh::VPropHandleT<std::uint32_t> origin_ph;
+        mesh.add_property(origin_ph);
+        for (size_t i = 0; i < origin.size(); ++i) {
+            mesh.property(origin_ph, halfedge_mesh::VertexHandle((int)i)) = origin[i] + 1;
+        }
+        for (size_t i = 0; i < copies.size(); ++i) {
+            mesh.property(origin_ph, halfedge_mesh::VertexHandle((int)(origin.size() + i))) = origin[copies[i]] + 1;
+        }
+
+        {
+            remesher_compact r(mesh);
+            r.set_lock_boundary(true);
+            r.remesh(target_edge_len, max_iter);
+        }
+
+        std::vector<std::uint32_t> global(mesh.n_vertices());
+        for (size_t i = 0; i < mesh.n_vertices(); ++i) {
+            halfedge_mesh::VertexHandle vh((int)i);
+            if (mesh.status(vh).deleted() || mesh.is_isolated(vh)) continue;
+            if (mesh.is_boundary(vh)) {
+                global[i] = seam_vertex(mesh.point(vh), mesh.property(origin_ph, vh), writer);
+            }
+            else {
+                global[i] = writer.write_vertex(mesh.point(vh).v);
+            }
+        }
+        for (size_t i = 0; i < mesh.n_faces(); ++i) {
+            halfedge_mesh::FaceHandle fh((int)i);
+            if (mesh.status(fh).deleted()) continue;
+            halfedge_mesh::HalfedgeHandle h0 = mesh.halfedge_handle(fh);
+            halfedge_mesh::HalfedgeHandle h1 = mesh.next_halfedge_handle(h0);
+            halfedge_mesh::HalfedgeHandle h2 = mesh.next_halfedge_handle(h1);
+            writer.write_face(global[mesh.to_vertex_handle(h0).idx()], global[mesh.to_vertex_handle(h1).idx()], global[mesh.to_vertex_handle(h2).idx()]);
+        }
+    }
+
+    // output index of a vertex on a chunk boundary, shared with the neighboring chunks
+    std::uint32_t seam_vertex(const halfedge_mesh::Point &p, std::uint32_t origin, ply_writer &writer) {
+        if (origin > 0) {
+            std::unordered_map<std::uint32_t, std::uint32_t>::iterator it = seam_ids.find(origin);
+            if (it == seam_ids.end()) {
+                it = seam_ids.emplace(origin, writer.write_vertex(p.v)).first;
+            }
+            return it->second;
+        }
+        std::array<float, 3> key = { { p[0], p[1], p[2] } };
+        std::map<std::array<float, 3>, std::uint32_t>::iterator it = seam_points.find(key);
+        if (it == seam_points.end()) {
+            it = seam_points.emplace(key, writer.write_vertex(p.v)).first;
+        }
+        return it->second;
+    }
+
+    std::string temp_path(const std::string &name) const {
+        return temp_dir + "/" + name;
+    }
+
+    std::string chunk_path(std::int64_t chunk) const {
+        return temp_path("chunk" + std::to_string(chunk) + ".bin");
+    }
+
+    std::string temp_dir;
+    float chunk_size = 1.0f;
+    size_t cache_pages = 1024;
+    size_t passes = 2;
+
+    std::unordered_map<std::uint32_t, std::uint32_t> seam_ids;
+    std::map<std::array<float, 3>, std::uint32_t> seam_points;
+};
+
+/*
+#include <cstdlib>
+#include <iostream>
+#include "StreamingRemesh.h"
+
+// every edge has two faces of opposite orientation and every vertex a single fan
+bool is_closed_manifold(const std::string &path) {
+    ply_reader reader;
+    if (!reader.open(path)) return false;
+    std::vector<halfedge_mesh::Point> points(reader.vertex_count());
+    for (size_t i = 0; i < points.size(); ++i) {
+        if (!reader.read_vertex(points[i].v)) return false;
+    }
+    std::vector<int> triangles;
+    std::vector<unsigned int> corners(points.size(), 0);
+    std::vector<int> polygon;
+    for (size_t f = 0; f < reader.face_count(); ++f) {
+        if (!reader.read_face(polygon) || polygon.size() != 3) return false;
+        for (int k = 0; k < 3; ++k) {
+            triangles.push_back(polygon[k]);
+            corners[polygon[k]]++;
+        }
+    }
+
+    halfedge_mesh mesh;
+    if (!mesh.build(points, triangles)) return false;
+    for (size_t i = 0; i < mesh.n_edges(); ++i) {
+        if (mesh.is_boundary(halfedge_mesh::EdgeHandle((int)i))) return false;
+    }
+    for (size_t i = 0; i < mesh.n_vertices(); ++i) {
+        if (mesh.valence(halfedge_mesh::VertexHandle((int)i)) != corners[i]) return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    streaming_remesher r("/tmp");
+    r.set_chunk_size((float)atof(argv[3]));
+    if (!r.remesh(argv[1], argv[2], (float)atof(argv[4]), 10)) {
+        std::cout << "Failed to remesh " << argv[1] << std::endl;
+        return 1;
+    }
+    // a closed input must stay closed across the seams
+    std::cout << "closed manifold: " << is_closed_manifold(argv[2]) << std::endl;
+    return 0;
+}
+*/
@@ -0,0 +1,211 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <limits>
+#include <numeric>
+#include <algorithm>
+
+/*
+    Bounding volume hierarchy over a static triangle mesh, for closest point queries.
+    The points and triangles are copied, so the source can change after build().
+    Queries are const and safe to run from many threads.
+*/
+class TriangleBVH {
+public:
+    typedef std::array<float, 3> point_type;
+    typedef std::array<int, 3> triangle_type;
+
+    TriangleBVH() {}
+
+    TriangleBVH(const std::vector<point_type> &points, const std::vector<triangle_type> &triangles) {
+        build(points, triangles);
+    }
+
+    void build(const std::vector<point_type> &points, const std::vector<triangle_type> &triangles) {
+        m_points = points;
+        m_triangles = triangles;
+        m_nodes.clear();
+        m_order.resize(m_triangles.size());
+        std::iota(m_order.begin(), m_order.end(), 0);
+        m_centroids.resize(m_triangles.size());
+        for (size_t i = 0; i < m_triangles.size(); ++i) {
+            for (int k = 0; k < 3; ++k) {
+                m_centroids[i][k] = (point(i, 0)[k] + point(i, 1)[k] + point(i, 2)[k]) / 3.0f;
+            }
+        }
+        if (!m_triangles.empty()) {
+            m_nodes.reserve(2 * m_triangles.size() / leaf_size + 1);
+            build_node(0, (int)m_triangles.size());
+        }
+        m_centroids.clear();
+    }
+
+    bool empty() const {
+        return m_nodes.empty();
+    }
+
+    // returns the closest triangle to p and its closest point, or -1 if empty
+    int closest_point(const point_type &p, point_type &closest) const {
+        int best = -1;
+        float best_sqrdist = std::numeric_limits<float>::max();
+        if (empty()) {
+            return best;
+        }
+
+        int stack[64];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const node &n = m_nodes[stack[--top]];
+            if (box_sqrdist(n, p) >= best_sqrdist) continue;
+            if (n.count > 0) {
+                for (int i = n.first; i < n.first + n.count; ++i) {
+                    int t = m_order[i];
+                    point_type q = closest_on_triangle(p, point(t, 0), point(t, 1), point(t, 2));
+                    float d = sqrdist(p, q);
+                    if (d < best_sqrdist) {
+                        best_sqrdist = d;
+                        best = t;
+                        closest = q;
+                    }
+                }
+            }
+            else {
+                // visit the nearer child first
+                int left = int(&n - &m_nodes[0]) + 1;
+                int right = n.right;
+                if (box_sqrdist(m_nodes[left], p) < box_sqrdist(m_nodes[right], p)) {
+                    std::swap(left, right);
+                }
+                stack[top++] = left;
+                stack[top++] = right;
+            }
+        }
+        return best;
+    }
+
+private:
+    static const int leaf_size = 4;
+
+    // left child follows its parent, count > 0 marks a leaf
+    struct node {
+        point_type lo;
+        point_type hi;
+        int first;
+        int count;
+        int right;
+    };
+
+    const point_type &point(size_t t, int k) const {
+        return m_points[m_triangles[t][k]];
+    }
+
+    int build_node(int first, int count) {
+        int index = (int)m_nodes.size();
+        m_nodes.emplace_back();
+        node n;
+        n.lo.fill(std::numeric_limits<float>::max());
+        n.hi.fill(-std::numeric_limits<float>::max());
+        point_type clo = n.lo;
+        point_type chi = n.hi;
+        for (int i = first; i < first + count; ++i) {
+            int t = m_order[i];
+            for (int k = 0; k < 3; ++k) {
+                for (int j = 0; j < 3; ++j) {
+                    n.lo[j] = std::min(n.lo[j], point(t, k)[j]);
+                    n.hi[j] = std::max(n.hi[j], point(t, k)[j]);
+                }
+            }
+            for (int j = 0; j < 3; ++j) {
+                clo[j] = std::min(clo[j], m_centroids[t][j]);
+                chi[j] = std::max(chi[j], m_centroids[t][j]);
+            }
+        }
+
+        if (count <= leaf_size) {
+            n.first = first;
+            n.count = count;
+            n.right = -1;
+        }
+        else {
+            // median split along the longest axis of the centroids
+            int axis = 0;
+            for (int j = 1; j < 3; ++j) {
+                if (chi[j] - clo[j] > chi[axis] - clo[axis]) {
+                    axis = j;
+                }
+            }
+            int half = count / 2;
+            std::nth_element(m_order.begin() + first, m_order.begin() + first + half, m_order.begin() + first + count, [this, axis](int a, int b) {
+                return m_centroids[a][axis] < m_centroids[b][axis];
+            });
+            n.first = first;
+            n.count = 0;
+            build_node(first, half);
+            n.right = build_node(first + half, count - half);
+        }
+        m_nodes[index] = n;
+        return index;
+    }
+
+    static float sqrdist(const point_type &a, const point_type &b) {
+        float d0 = a[0] - b[0], d1 = a[1] - b[1], d2 = a[2] - b[2];
+        return d0*d0 + d1*d1 + d2*d2;
+    }
+
+    static float box_sqrdist(const node &n, const point_type &p) {
+        float d = 0.0f;
+        for (int j = 0; j < 3; ++j) {
+            float e = std::max(std::max(n.lo[j] - p[j], p[j] - n.hi[j]), 0.0f);
+            d += e*e;
+        }
+        return d;
+    }
+
+    // Real-Time Collision Detection, C. Ericson, 2005, 5.1.5.
+    static point_type closest_on_triangle(const point_type &p, const point_type &a, const point_type &b, const point_type &c) {
+        point_type ab = sub(b, a), ac = sub(c, a), ap = sub(p, a);
+        float d1 = dot(ab, ap), d2 = dot(ac, ap);
+        if (d1 <= 0.0f && d2 <= 0.0f) return a;
+
+        point_type bp = sub(p, b);
+        float d3 = dot(ab, bp), d4 = dot(ac, bp);
+        if (d3 >= 0.0f && d4 <= d3) return b;
+
+        float vc = d1*d4 - d3*d2;
+        if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) return mad(a, ab, d1 / (d1 - d3));
+
+        point_type cp = sub(p, c);
+        float d5 = dot(ab, cp), d6 = dot(ac, cp);
+        if (d6 >= 0.0f && d5 <= d6) return c;
+
+        float vb = d5*d2 - d1*d6;
+        if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) return mad(a, ac, d2 / (d2 - d6));
+
+        float va = d3*d6 - d5*d4;
+        if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) return mad(b, sub(c, b), (d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+        float denom = 1.0f / (va + vb + vc);
+        return mad(mad(a, ab, vb*denom), ac, vc*denom);
+    }
+
+    static point_type sub(const point_type &a, const point_type &b) {
+        return point_type{ { a[0] - b[0], a[1] - b[1], a[2] - b[2] } };
+    }
+
+    static float dot(const point_type &a, const point_type &b) {
+        return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    }
+
+    // a + s*d
+    static point_type mad(const point_type &a, const point_type &d, float s) {
+        return point_type{ { a[0] + s*d[0], a[1] + s*d[1], a[2] + s*d[2] } };
+    }
+
+    std::vector<point_type> m_points;
+    std::vector<triangle_type> m_triangles;
+    std::vector<node> m_nodes;
+    std::vector<int> m_order;
+    std::vector<point_type> m_centroids;
+};
@@ -3,17 +3,496 @@
 #include <cmath>
 #include <array>
 #include <vector>
+#include <memory>
 #include <limits>
+#include <utility>
+#include <functional>
+#include <unordered_map>
 #include <type_traits>
 
+/*
+    Calls f(std::integral_constant<size_t, I>()) for I = 0 .. N-1, unrolled at compile time.
+*/
+template <typename F, size_t... I>
+inline void fast_marching_unroll_impl(F &&f, std::index_sequence<I...>) {
+    int expand[] = { 0, (f(std::integral_constant<size_t, I>()), 0)... };
+    (void)expand;
+}
+
+template <size_t N, typename F>
+inline void fast_marching_unroll(F &&f) {
+    fast_marching_unroll_impl(f, std::make_index_sequence<N>());
+}
+
+/*
+    Voxel layouts map space indices to voxel indices (and back).
+    Every layout pads the grid with one voxel on each side, so that neighbor<Direction>(v)
+    of an inside voxel is always addressable and needs no bounds check.
+    Direction d < Dimension steps +1 along axis d, Direction Dimension + d steps -1.
+    is_inside(v) tells padding voxels apart, fast_marching marks them in storage.
+
+    fast_marching_linear_layout is the plain row-major order, neighbors are fixed strides.
+    fast_marching_brick_layout groups voxels into bricks of 2^BrickBits per side,
+    each brick occupies a consecutive range of voxel indices. Paired with sparse
+    storage, a storage page is then a compact brick in space.
+    fast_marching_morton_layout uses Z-order over the padded bounding power-of-two cube,
+    it keeps neighbors close in memory along every axis. Capacity is rounded up to a cube,
+    so use it densely only for grids that are roughly cubic.
+*/
 template <size_t Dimension>
-class fast_marching {
-    typedef double value_type;
+class fast_marching_linear_layout {
+public:
+    typedef std::array<size_t, Dimension> space_index;
+
+    void resize(const space_index &sizes) {
+        m_sizes = sizes;
+        size_t stride = 1;
+        for (size_t d = Dimension - 1; d < Dimension; --d) {
+            m_strides[d] = stride;
+            stride *= m_sizes[d] + 2;
+        }
+        m_capacity = stride;
+    }
+
+    size_t capacity() const {
+        return m_capacity;
+    }
+
+    size_t encode(const space_index &s) const {
+        size_t v = 0;
+        // [unroll]
+        for (size_t d = 0; d < Dimension; ++d) {
+            v += (s[d] + 1)*m_strides[d];
+        }
+        return v;
+    }
+
+    // padding voxels decode to coordinate -1 or size
+    void decode(size_t v, space_index &s) const {
+        // [unroll]
+        for (size_t d = 0; d < Dimension; ++d) {
+            s[d] = v / m_strides[d] - 1;
+            v %= m_strides[d];
+        }
+    }
+
+    bool is_inside(size_t v) const {
+        space_index s;
+        decode(v, s);
+        for (size_t d = 0; d < Dimension; ++d) {
+            if (s[d] >= m_sizes[d]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template <size_t Direction>
+    size_t neighbor(size_t v) const {
+        return (Direction < Dimension) ? v + m_strides[Direction % Dimension] : v - m_strides[Direction % Dimension];
+    }
+
+private:
+    space_index m_sizes;
+    space_index m_strides;
+    size_t m_capacity;
+};
+
+template <size_t Dimension, size_t BrickBits = 3>
+class fast_marching_brick_layout {
+    static const size_t brick_side_mask = (size_t(1) << BrickBits) - 1;
+public:
+    typedef std::array<size_t, Dimension> space_index;
+
+    // log2 of voxel count in one brick
+    static const size_t brick_bits = BrickBits*Dimension;
+
+    void resize(const space_index &sizes) {
+        m_sizes = sizes;
+        size_t stride = 1;
+        for (size_t d = Dimension - 1; d < Dimension; --d) {
+            m_bricks[d] = (m_sizes[d] + 2 + brick_side_mask) >> BrickBits;
+            m_brick_strides[d] = stride << brick_bits;
+            stride *= m_bricks[d];
+        }
+        m_capacity = stride << brick_bits;
+    }
+
+    size_t capacity() const {
+        return m_capacity;
+    }
+
+    size_t encode(const space_index &s) const {
+        size_t b = 0;
+        size_t l = 0;
+        // [unroll]
+        for (size_t d = 0; d < Dimension; ++d) {
+            size_t p = s[d] + 1;
+            b = b*m_bricks[d] + (p >> BrickBits);
+            l = (l << BrickBits) | (p & brick_side_mask);
+        }
+        return (b << brick_bits) | l;
+    }
+
+    // padding voxels decode to coordinate -1 or beyond size
+    void decode(size_t v, space_index &s) const {
+        size_t b = v >> brick_bits;
+        size_t l = v;
+        // [unroll]
+        for (size_t d = Dimension - 1; d < Dimension; --d) {
+            s[d] = (((b % m_bricks[d]) << BrickBits) | (l & brick_side_mask)) - 1;
+            b /= m_bricks[d];
+            l >>= BrickBits;
+        }
+    }
+
+    bool is_inside(size_t v) const {
+        space_index s;
+        decode(v, s);
+        for (size_t d = 0; d < Dimension; ++d) {
+            if (s[d] >= m_sizes[d]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template <size_t Direction>
+    size_t neighbor(size_t v) const {
+        const size_t d = Direction % Dimension;
+        const size_t shift = BrickBits*(Dimension - 1 - d);
+        size_t c = (v >> shift) & brick_side_mask;
+        if (Direction < Dimension) {
+            return (c != brick_side_mask) ? v + (size_t(1) << shift) : v - (brick_side_mask << shift) + m_brick_strides[d];
+        }
+        else {
+            return (c != 0) ? v - (size_t(1) << shift) : v + (brick_side_mask << shift) - m_brick_strides[d];
+        }
+    }
+
+private:
+    space_index m_sizes;
+    space_index m_bricks;
+    space_index m_brick_strides;
+    size_t m_capacity;
+};
+
+template <size_t Dimension>
+class fast_marching_morton_layout {
+    static const size_t index_bits = sizeof(size_t)*8;
+public:
+    typedef std::array<size_t, Dimension> space_index;
+
+    void resize(const space_index &sizes) {
+        m_sizes = sizes;
+        m_bits = 0;
+        for (size_t d = 0; d < Dimension; ++d) {
+            while ((size_t(1) << m_bits) < m_sizes[d] + 2) {
+                m_bits++;
+            }
+        }
+    }
+
+    size_t capacity() const {
+        return size_t(1) << (m_bits*Dimension);
+    }
+
+    size_t encode(const space_index &s) const {
+        size_t v = 0;
+        for (size_t d = 0; d < Dimension; ++d) {
+            size_t p = s[d] + 1;
+            for (size_t i = 0; i < m_bits; ++i) {
+                v |= ((p >> i) & 1) << (i*Dimension + Dimension - 1 - d);
+            }
+        }
+        return v;
+    }
+
+    // padding voxels decode to coordinate -1 or beyond size
+    void decode(size_t v, space_index &s) const {
+        for (size_t d = 0; d < Dimension; ++d) {
+            size_t p = 0;
+            for (size_t i = 0; i < m_bits; ++i) {
+                p |= ((v >> (i*Dimension + Dimension - 1 - d)) & 1) << i;
+            }
+            s[d] = p - 1;
+        }
+    }
+
+    bool is_inside(size_t v) const {
+        space_index s;
+        decode(v, s);
+        for (size_t d = 0; d < Dimension; ++d) {
+            if (s[d] >= m_sizes[d]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template <size_t Direction>
+    size_t neighbor(size_t v) const {
+        // add or subtract one on the dilated bits of one axis, carries skip the other axes
+        const size_t m = axis_mask(Dimension - 1 - Direction % Dimension);
+        if (Direction < Dimension) {
+            return (((v | ~m) + 1) & m) | (v & ~m);
+        }
+        else {
+            return (((v & m) - 1) & m) | (v & ~m);
+        }
+    }
+
+private:
+    static constexpr size_t axis_mask(size_t first_bit) {
+        size_t m = 0;
+        for (size_t i = first_bit; i < index_bits; i += Dimension) {
+            m |= size_t(1) << i;
+        }
+        return m;
+    }
+
+    space_index m_sizes;
+    size_t m_bits;
+};
+
+/*
+    Voxel storages hold value, state and heap back reference of every voxel,
+    and the originating seed when seed tracking is requested in reset().
+    reset() takes the layout, voxels outside layout.is_inside() start in the padding state.
+    fast_marching_dense_storage allocates everything in reset().
+    fast_marching_sparse_storage allocates pages of 2^PageBits voxels on first write,
+    untouched voxels read as the defaults given to reset().
+*/
+template <typename T>
+class fast_marching_dense_storage {
+public:
+    typedef T value_type;
+    typedef char state_type;
+    typedef size_t heap_index;
+    typedef unsigned int seed_type;
+
+    template <typename Layout>
+    void reset(const Layout &layout, value_type value, state_type state, state_type padding_state, heap_index heap, seed_type seed, bool track_seeds) {
+        size_t capacity = layout.capacity();
+        m_values.assign(capacity, value);
+        m_states.resize(capacity);
+        for (size_t v = 0; v < capacity; ++v) {
+            m_states[v] = layout.is_inside(v) ? state : padding_state;
+        }
+        m_heaps.assign(capacity, heap);
+        if (track_seeds) {
+            m_seeds.assign(capacity, seed);
+        }
+        else {
+            std::vector<seed_type>().swap(m_seeds);
+        }
+    }
+
+    const value_type &value(size_t v) const {
+        return m_values[v];
+    }
+
+    const state_type &state(size_t v) const {
+        return m_states[v];
+    }
+
+    const heap_index &heap(size_t v) const {
+        return m_heaps[v];
+    }
+
+    value_type &value_ref(size_t v) {
+        return m_values[v];
+    }
+
+    state_type &state_ref(size_t v) {
+        return m_states[v];
+    }
+
+    heap_index &heap_ref(size_t v) {
+        return m_heaps[v];
+    }
+
+    const seed_type &seed(size_t v) const {
+        return m_seeds[v];
+    }
+
+    seed_type &seed_ref(size_t v) {
+        return m_seeds[v];
+    }
+
+    size_t memory_usage() const {
+        return m_values.capacity()*sizeof(value_type) + m_states.capacity()*sizeof(state_type) + m_heaps.capacity()*sizeof(heap_index) + m_seeds.capacity()*sizeof(seed_type);
+    }
+
+private:
+    std::vector<value_type> m_values;
+    std::vector<state_type> m_states;
+    std::vector<heap_index> m_heaps;
+    std::vector<seed_type> m_seeds;
+};
+
+template <typename T, size_t PageBits = 9>
+class fast_marching_sparse_storage {
+public:
+    typedef T value_type;
     typedef char state_type;
-    typedef size_t voxel_index;
     typedef size_t heap_index;
+    typedef unsigned int seed_type;
+
+    static const size_t page_bits = PageBits;
+    static const size_t page_size = size_t(1) << PageBits;
+
+    template <typename Layout>
+    void reset(const Layout &layout, value_type value, state_type state, state_type padding_state, heap_index heap, seed_type seed, bool track_seeds) {
+        m_pages.clear();
+        m_cached_key = page_nil;
+        m_cached_page = nullptr;
+        m_default_value = value;
+        m_default_state = state;
+        m_padding_state = padding_state;
+        m_default_heap = heap;
+        m_default_seed = seed;
+        m_track_seeds = track_seeds;
+        m_is_inside = [layout](size_t v) {
+            return layout.is_inside(v);
+        };
+    }
+
+    const value_type &value(size_t v) const {
+        const page *p = page_find(v >> page_bits);
+        return p ? p->values[v & page_mask] : m_default_value;
+    }
+
+    // voxels of missing pages read as they would start once allocated
+    state_type state(size_t v) const {
+        const page *p = page_find(v >> page_bits);
+        if (p) {
+            return p->states[v & page_mask];
+        }
+        return m_is_inside(v) ? m_default_state : m_padding_state;
+    }
+
+    const heap_index &heap(size_t v) const {
+        const page *p = page_find(v >> page_bits);
+        return p ? p->heaps[v & page_mask] : m_default_heap;
+    }
+
+    value_type &value_ref(size_t v) {
+        return page_touch(v >> page_bits)->values[v & page_mask];
+    }
+
+    state_type &state_ref(size_t v) {
+        return page_touch(v >> page_bits)->states[v & page_mask];
+    }
+
+    heap_index &heap_ref(size_t v) {
+        return page_touch(v >> page_bits)->heaps[v & page_mask];
+    }
+
+    const seed_type &seed(size_t v) const {
+        const page *p = page_find(v >> page_bits);
+        return p ? p->seeds[v & page_mask] : m_default_seed;
+    }
+
+    seed_type &seed_ref(size_t v) {
+        return page_touch(v >> page_bits)->seeds[v & page_mask];
+    }
+
+    size_t page_count() const {
+        return m_pages.size();
+    }
+
+    size_t memory_usage() const {
+        return m_pages.size()*(sizeof(page) + sizeof(typename page_map::value_type) + (m_track_seeds ? page_size*sizeof(seed_type) : 0));
+    }
+
+private:
+    static const size_t page_mask = page_size - 1;
+    static const size_t page_nil = size_t(-1);
+
+    struct page {
+        std::array<value_type, page_size> values;
+        std::array<state_type, page_size> states;
+        std::array<heap_index, page_size> heaps;
+        std::vector<seed_type> seeds;
+    };
+    typedef std::unordered_map<size_t, std::unique_ptr<page>> page_map;
+
+    page *page_find(size_t key) const {
+        // marching touches voxels in spatially coherent order, one cached page saves most hashing
+        if (key != m_cached_key) {
+            typename page_map::const_iterator it = m_pages.find(key);
+            m_cached_key = key;
+            m_cached_page = (it != m_pages.end()) ? it->second.get() : nullptr;
+        }
+        return m_cached_page;
+    }
+
+    page *page_touch(size_t key) {
+        page *p = page_find(key);
+        if (!p) {
+            std::unique_ptr<page> &np = m_pages[key];
+            np.reset(new page);
+            np->values.fill(m_default_value);
+            size_t first = key << page_bits;
+            for (size_t i = 0; i < page_size; ++i) {
+                np->states[i] = m_is_inside(first + i) ? m_default_state : m_padding_state;
+            }
+            np->heaps.fill(m_default_heap);
+            if (m_track_seeds) {
+                np->seeds.assign(page_size, m_default_seed);
+            }
+            p = m_cached_page = np.get();
+        }
+        return p;
+    }
+
+    page_map m_pages;
+    mutable size_t m_cached_key = page_nil;
+    mutable page *m_cached_page = nullptr;
+
+    value_type m_default_value;
+    state_type m_default_state;
+    state_type m_padding_state;
+    heap_index m_default_heap;
+    seed_type m_default_seed;
+    bool m_track_seeds = false;
+    std::function<bool(size_t)> m_is_inside;
+};
+
+/*
+    T selects value precision, float halves the value storage.
+    Layout and Storage select how voxels are numbered and stored, see above.
+    The default dense row-major setup allocates every voxel in reset().
+    For large grids with a small band threshold, use sparse_fast_marching below,
+    memory then scales with the marched band instead of the whole volume.
+
+    With seed tracking, every voxel also records the seed it was reached from,
+    which gives a Voronoi partition of the seeds for free.
+    With second order, the upwind difference uses two accepted voxels when available,
+    (3T - 4T1 + T2)/2, which is more accurate on coarse grids.
+
+    After march(), seeds can be added, moved or removed incrementally:
+    set_init_voxel() sends a lowering wave that reopens voxels it improves,
+    remove_init_voxel() sends a raising wave that invalidates voxels no longer supported.
+    Any number of edits may be batched, the next march() then only re-propagates the affected region.
+    First order results match a full re-march, band threshold included, second order ones agree up to discretization error.
+*/
+template <size_t Dimension, typename T = double, typename Layout = fast_marching_linear_layout<Dimension>, typename Storage = fast_marching_dense_storage<T>>
+class fast_marching {
+public:
+    typedef T value_type;
     typedef std::array<size_t, Dimension> space_index;
+    typedef typename Storage::seed_type seed_type;
+
+    static const seed_type seed_nil = seed_type(-1);
+
+private:
+    typedef typename Storage::state_type state_type;
+    typedef size_t voxel_index;
+    typedef typename Storage::heap_index heap_index;
     static_assert(std::is_unsigned<size_t>::value, "space_index must use unsigned type!");
+    static_assert(std::is_same<typename Storage::value_type, value_type>::value, "Storage must hold value_type!");
 
 public:
     static const size_t dimension = Dimension;
@@ -30,32 +509,91 @@ public:
         return m_band_threshold;
     }
 
-    void set_band_threshold(double t) {
+    void set_band_threshold(value_type t) {
         m_band_threshold = t;
     }
 
+    bool get_track_seeds() const {
+        return m_track_seeds;
+    }
+
+    // takes effect on next reset()
+    void set_track_seeds(bool track) {
+        m_track_seeds = track;
+    }
+
+    bool get_second_order() const {
+        return m_second_order;
+    }
+
+    void set_second_order(bool second_order) {
+        m_second_order = second_order;
+    }
+
     void reset() {
+        m_layout.resize(m_sizes);
         voxel_reset();
         heap_reset();
+        m_marched = false;
     }
 
     void march() {
         while (heap_size() > 0) {
             voxel_index v = heap_pop();
-            m_voxel_states[v] = voxel_state_accepted;
+            if (voxel_state(v) != voxel_state_seed) {
+                m_storage.state_ref(v) = voxel_state_accepted;
+            }
             if (voxel_value(v) < m_band_threshold) {
-                space_index s;
-                voxel_to_space_decompose(v, s);
-                voxel_update_neighbors(s);
+                voxel_update_neighbors(v);
             }
         }
+        m_marched = true;
+    }
+
+    void set_init_voxel(const space_index &s, const value_type &value, seed_type seed = seed_nil) {
+        voxel_index v = space_to_voxel(s);
+        bool raise = m_marched && value > voxel_value(v);
+        voxel_set_value(v, value);
+        m_storage.state_ref(v) = voxel_state_seed;
+        if (m_track_seeds) {
+            m_storage.seed_ref(v) = seed;
+        }
+        if (raise) {
+            voxel_raise(v);
+        }
+        voxel_update_neighbors(v);
     }
 
-    void set_init_voxel(const space_index &s, const value_type &value) {
+    // returns false if s is not an init voxel
+    bool remove_init_voxel(const space_index &s) {
         voxel_index v = space_to_voxel(s);
-        m_voxel_values[v] = value;
-        m_voxel_states[v] = voxel_state_accepted;
-        voxel_update_neighbors(s);
+        if (voxel_state(v) != voxel_state_seed) {
+            return false;
+        }
+        voxel_invalidate(v);
+        voxel_raise(v);
+        return true;
+    }
+
+    // voxels not reached by marching read as std::numeric_limits<value_type>::max()
+    value_type get_value(const space_index &s) const {
+        if (!space_is_inside(s)) {
+            return voxel_value_inf;
+        }
+        return voxel_value(space_to_voxel(s));
+    }
+
+    // seed given to set_init_voxel() of the closest seed, seed_nil if not tracked or not reached
+    seed_type get_seed(const space_index &s) const {
+        if (!m_track_seeds || !space_is_inside(s)) {
+            return seed_nil;
+        }
+        return m_storage.seed(space_to_voxel(s));
+    }
+
+    // bytes held by voxel storage and heap
+    size_t memory_usage() const {
+        return m_storage.memory_usage() + m_heap_perms.capacity()*sizeof(voxel_index);
     }
 
 private:
@@ -63,6 +601,8 @@ private:
     /*constexpr*/ const value_type voxel_value_inf = std::numeric_limits<value_type>::max();
     static const state_type voxel_state_unknown = 0;
     static const state_type voxel_state_accepted = 1;
+    static const state_type voxel_state_padding = 2;
+    static const state_type voxel_state_seed = 3;
 
     bool space_is_inside(const space_index &s) const {
         // [unroll]
@@ -76,30 +616,57 @@ private:
     }
 
     void voxel_reset() {
-        size_t c = voxel_count();
-        m_voxel_values.swap(std::vector<value_type>(c, voxel_value_inf));
-        m_voxel_states.swap(std::vector<state_type>(c, voxel_state_unknown));
+        m_storage.reset(m_layout, voxel_value_inf, voxel_state_unknown, voxel_state_padding, heap_nil, seed_nil, m_track_seeds);
     }
 
-    size_t voxel_count() const {
-        size_t c = 1;
-        for (size_t d = 0; d < dimension; ++d) {
-            c *= m_sizes[d];
-        }
-        return c;
+    const value_type &voxel_value(const voxel_index &v) const {
+        return m_storage.value(v);
     }
 
-    const value_type &voxel_value(const voxel_index &v) const {
-        return m_voxel_values[v];
+    state_type voxel_state(const voxel_index &v) const {
+        return m_storage.state(v);
+    }
+
+    // voxels a neighbor may be solved from: seeds, and accepted voxels inside the band,
+    // marching does not spread past the band, so incremental waves must not either
+    bool voxel_is_upwind(const voxel_index &v) const {
+        state_type state = voxel_state(v);
+        return state == voxel_state_seed || (state == voxel_state_accepted && voxel_value(v) < m_band_threshold);
+    }
+
+    // incremental updates ignore changes below this, so rounding noise does not reopen voxels
+    static value_type voxel_tolerance(const value_type &value) {
+        return std::sqrt(std::numeric_limits<value_type>::epsilon())*(1 + value);
+    }
+
+    void voxel_invalidate(const voxel_index &v) {
+        heap_index h = voxel_to_heap(v);
+        if (h != heap_nil) {
+            heap_remove(h);
+        }
+        m_storage.state_ref(v) = voxel_state_unknown;
+        m_storage.value_ref(v) = voxel_value_inf;
+        if (m_track_seeds) {
+            m_storage.seed_ref(v) = seed_nil;
+        }
     }
 
-    const state_type &voxel_state(const voxel_index &v) const {
-        return m_voxel_states[v];
+    void voxel_push(const voxel_index &v, const value_type &value, seed_type seed) {
+        if (m_track_seeds) {
+            m_storage.seed_ref(v) = seed;
+        }
+        if (voxel_to_heap(v) == heap_nil) {
+            m_storage.value_ref(v) = value;
+            heap_push(v);
+        }
+        else {
+            voxel_set_value(v, value);
+        }
     }
 
     void voxel_set_value(const voxel_index &v, const value_type &value) {
         value_type value_old = voxel_value(v);
-        m_voxel_values[v] = value;
+        m_storage.value_ref(v) = value;
         heap_index h = voxel_to_heap(v);
         if (h != heap_nil) {
             if (value < value_old) {
@@ -111,70 +678,122 @@ private:
         }
     }
 
-    value_type voxel_value_solve(const voxel_index &v, space_index s) const {
-        int n = 0;
-        value_type sval = 0.0;
-        value_type sqval = 0.0;
-
-        for (size_t d = 0; d < dimension; ++d) {
-            value_type val = voxel_value_inf;
-            bool has_val = false;
-            s[d]++;
-            if (space_is_inside(s)) {
-                voxel_index v = space_to_voxel(s);
-                if (voxel_state(v) == voxel_state_accepted) {
-                    val = std::min(val, voxel_value(v));
-                    has_val = true;
-                }
+    value_type voxel_value_solve(const voxel_index &v, seed_type &seed) const {
+        // each axis contributes a*(T - t)^2 to the eikonal equation sum(...) = 1,
+        // first order: a = 1, t = T1; second order: a = 9/4, t = (4*T1 - T2)/3
+        std::array<value_type, Dimension> ts;
+        std::array<value_type, Dimension> as;
+        std::array<voxel_index, Dimension> vs;
+        size_t n = 0;
+
+        fast_marching_unroll<dimension>([&](auto d) {
+            voxel_index v1 = m_layout.template neighbor<decltype(d)::value>(v);
+            voxel_index v1n = m_layout.template neighbor<decltype(d)::value + dimension>(v);
+            bool forward = true;
+            if (voxel_is_upwind(v1n) && (!voxel_is_upwind(v1) || voxel_value(v1n) < voxel_value(v1))) {
+                v1 = v1n;
+                forward = false;
+            }
+            if (!voxel_is_upwind(v1)) {
+                return;
             }
-            s[d] -= 2;
-            if (space_is_inside(s)) {
-                voxel_index v = space_to_voxel(s);
-                if (voxel_state(v) == voxel_state_accepted) {
-                    val = std::min(val, voxel_value(v));
-                    has_val = true;
+
+            value_type t = voxel_value(v1);
+            value_type a = 1;
+            if (m_second_order) {
+                // v1 is accepted hence inside, its neighbor is addressable
+                voxel_index v2 = forward ? m_layout.template neighbor<decltype(d)::value>(v1) : m_layout.template neighbor<decltype(d)::value + dimension>(v1);
+                if (voxel_is_upwind(v2) && voxel_value(v2) <= t) {
+                    t = (4 * t - voxel_value(v2)) / 3;
+                    a = value_type(9) / 4;
                 }
             }
-            s[d]++;
 
-            if (has_val) {
-                n++;
-                sval += val;
-                sqval += val*val;
+            // insert sorted by t
+            size_t i = n++;
+            for (; i > 0 && ts[i - 1] > t; --i) {
+                ts[i] = ts[i - 1];
+                as[i] = as[i - 1];
+                vs[i] = vs[i - 1];
+            }
+            ts[i] = t;
+            as[i] = a;
+            vs[i] = v1;
+        });
+
+        value_type sa = 0.0;
+        value_type sat = 0.0;
+        value_type satt = 0.0;
+        value_type value = voxel_value_inf;
+        for (size_t i = 0; i < n; ++i) {
+            // axes upwind values not below current solution cannot contribute
+            if (i > 0 && value <= ts[i]) {
+                break;
             }
+            sa += as[i];
+            sat += as[i] * ts[i];
+            satt += as[i] * ts[i] * ts[i];
+            value_type disc = sat*sat - sa*(satt - 1);
+            if (disc < 0) {
+                break;
+            }
+            value = (sat + sqrt(disc)) / sa;
         }
 
-        return (sval + sqrt(sval*sval - n*(sqval - 1))) / n;
+        seed = (m_track_seeds && n > 0) ? m_storage.seed(vs[0]) : seed_nil;
+        return value;
     }
 
-    void voxel_update_neighbors(const space_index &s) {
-        space_index ns = s;
-        // [unroll]
-        for (size_t td = 0; td < dimension*2; ++td) {
-            if (td < dimension) {
-                ns[td%dimension]++;
+    void voxel_update_neighbors(const voxel_index &v) {
+        fast_marching_unroll<dimension * 2>([&](auto td) {
+            voxel_index nv = m_layout.template neighbor<decltype(td)::value>(v);
+            // padding voxels are never unknown, so no bounds check is needed
+            state_type state = voxel_state(nv);
+            if (state == voxel_state_unknown) {
+                seed_type seed;
+                value_type value = voxel_value_solve(nv, seed);
+                voxel_push(nv, value, seed);
             }
-            else {
-                ns[td%dimension]--;
+            else if (m_marched && state == voxel_state_accepted) {
+                // lowering wave: reopen accepted voxels that v now improves
+                seed_type seed;
+                value_type value = voxel_value_solve(nv, seed);
+                if (value + voxel_tolerance(value) < voxel_value(nv)) {
+                    m_storage.state_ref(nv) = voxel_state_unknown;
+                    voxel_push(nv, value, seed);
+                }
             }
-            if (space_is_inside(ns)) {
-                voxel_index v = space_to_voxel(ns);
-                if (voxel_state(v) != voxel_state_accepted) {
-                    double value = voxel_value_solve(v, ns);
-                    if (voxel_to_heap(v) == heap_nil) {
-                        m_voxel_values[v] = value;
-                        heap_push(v);
-                    }
-                    else {
-                        voxel_set_value(v, value);
+        });
+    }
+
+    // raising wave: starting around v, invalidate accepted and queued voxels whose value is no
+    // longer supported by their accepted neighbors, then queue the invalidated region to be marched again.
+    // Queued voxels are checked too, their values may rest on a voxel invalidated by this or an earlier
+    // edit, so several edits can be batched before one march().
+    void voxel_raise(const voxel_index &v) {
+        std::vector<voxel_index> front(1, v);
+        for (size_t i = 0; i < front.size(); ++i) {
+            voxel_index u = front[i];
+            fast_marching_unroll<dimension * 2>([&](auto td) {
+                voxel_index nv = m_layout.template neighbor<decltype(td)::value>(u);
+                state_type state = voxel_state(nv);
+                if (state == voxel_state_accepted || (state == voxel_state_unknown && voxel_value(nv) < voxel_value_inf)) {
+                    seed_type seed;
+                    value_type value = voxel_value_solve(nv, seed);
+                    if (value > voxel_value(nv) + voxel_tolerance(voxel_value(nv))) {
+                        voxel_invalidate(nv);
+                        front.push_back(nv);
                     }
                 }
-            }
-            if (td < dimension) {
-                ns[td%dimension]--;
-            }
-            else {
-                ns[td%dimension]++;
+            });
+        }
+        for (size_t i = 0; i < front.size(); ++i) {
+            if (voxel_state(front[i]) == voxel_state_unknown) {
+                seed_type seed;
+                value_type value = voxel_value_solve(front[i], seed);
+                if (value < voxel_value_inf) {
+                    voxel_push(front[i], value, seed);
+                }
             }
         }
     }
@@ -196,29 +815,14 @@ private:
     }
 
     const heap_index &voxel_to_heap(const voxel_index &v) const {
-        return m_heap_brefs[v];
+        return m_storage.heap(v);
     }
 
     voxel_index space_to_voxel(const space_index &s) const {
-        voxel_index v = s[0];
-        // [unroll]
-        for (size_t d = 1; d < dimension; ++d) {
-            v = v*m_sizes[d] + s[d];
-        }
-        return v;
-    }
-
-    void voxel_to_space_decompose(voxel_index v, space_index &s) const {
-        // [unroll]
-        for (size_t d = dimension - 1; d > 0; --d) {
-            s[d] = v % m_sizes[d];
-            v /= m_sizes[d];
-        }
-        s[0] = v;
+        return m_layout.encode(s);
     }
 
     void heap_reset() {
-        m_heap_brefs.swap(std::vector<heap_index>(voxel_count(), heap_nil));
         m_heap_perms.clear();
     }
 
@@ -227,7 +831,7 @@ private:
     }
 
     void heap_swap(const heap_index &h1, const heap_index &h2) {
-        std::swap(m_heap_brefs[heap_to_voxel(h1)], m_heap_brefs[heap_to_voxel(h2)]);
+        std::swap(m_storage.heap_ref(heap_to_voxel(h1)), m_storage.heap_ref(heap_to_voxel(h2)));
         std::swap(m_heap_perms[h1], m_heap_perms[h2]);
     }
 
@@ -235,17 +839,31 @@ private:
         heap_index h = heap_size();
 
         m_heap_perms.push_back(v);
-        m_heap_brefs[v] = h;
+        m_storage.heap_ref(v) = h;
 
         heap_decrease(h);
     }
 
+    void heap_remove(const heap_index &h) {
+        voxel_index v = heap_to_voxel(h);
+        heap_index last = heap_size() - 1;
+        heap_swap(h, last);
+
+        m_heap_perms.pop_back();
+        m_storage.heap_ref(v) = heap_nil;
+
+        if (h < last) {
+            heap_decrease(h);
+            heap_increase(h);
+        }
+    }
+
     voxel_index heap_pop() {
         voxel_index v = heap_to_voxel(0);
         heap_swap(0, heap_size() - 1);
 
         m_heap_perms.pop_back();
-        m_heap_brefs[v] = heap_nil;
+        m_storage.heap_ref(v) = heap_nil;
 
         heap_increase(0);
 
@@ -259,7 +877,7 @@ private:
             h = parent;
         }
     }
-    
+
     void heap_increase(heap_index h) {
         size_t target, left, right;
         while (h < heap_size()) {
@@ -283,12 +901,102 @@ private:
     }
 
     std::array<size_t, Dimension> m_sizes;
-    
-    std::vector<value_type> m_voxel_values;
-    std::vector<state_type> m_voxel_states;
 
-    std::vector<heap_index> m_heap_brefs;
+    Layout m_layout;
+    Storage m_storage;
+
     std::vector<voxel_index> m_heap_perms;
 
     value_type m_band_threshold = std::numeric_limits<value_type>::max();
-};
\ No newline at end of file
+    bool m_track_seeds = false;
+    bool m_second_order = false;
+    bool m_marched = false;
+};
+
+/*
+    Blocked sparse marching: voxels are numbered brick by brick (8^Dimension voxels per brick),
+    one brick per storage page, pages are hashed and allocated when marching first touches them.
+*/
+template <size_t Dimension, typename T = float>
+using sparse_fast_marching = fast_marching<Dimension, T, fast_marching_brick_layout<Dimension, 3>, fast_marching_sparse_storage<T, fast_marching_brick_layout<Dimension, 3>::brick_bits>>;
+
+/*
+#include <cstdio>
+#include <random>
+#include "fast_marching.h"
+#include "unique_timer.h"
+
+template <typename FM>
+void bench(const char *name, size_t n, double band) {
+    FM fm;
+    for (size_t d = 0; d < FM::dimension; ++d) {
+        fm.set_size(d, n);
+    }
+    fm.set_band_threshold(band);
+    auto timer = make_timer([name, &fm](double t) {
+        printf("%-10s %8.3fs %12zu bytes\n", name, t, fm.memory_usage());
+    });
+    fm.reset();
+    typename FM::space_index s;
+    s.fill(n / 2);
+    fm.set_init_voxel(s, 0);
+    fm.march();
+}
+
+// several seed edits followed by one incremental march, against a march from scratch,
+// voxels the band leaves unreached read as max() in both, so a mismatch there shows as a huge error
+double check_incremental(size_t n, unsigned seed, double band) {
+    fast_marching<3> inc, ref;
+    for (size_t d = 0; d < 3; ++d) {
+        inc.set_size(d, n);
+        ref.set_size(d, n);
+    }
+    inc.set_band_threshold(band);
+    ref.set_band_threshold(band);
+    inc.reset();
+    ref.reset();
+    std::mt19937 rng(seed);
+    std::vector<fast_marching<3>::space_index> seeds(8);
+    for (auto &s : seeds) {
+        for (size_t d = 0; d < 3; ++d) {
+            s[d] = rng() % n;
+        }
+        inc.set_init_voxel(s, 0);
+    }
+    inc.march();
+    // remove three seeds and move two
+    for (size_t i = 0; i < 5; ++i) {
+        inc.remove_init_voxel(seeds[i]);
+    }
+    for (size_t i = 3; i < 5; ++i) {
+        seeds[i][0] = (seeds[i][0] + n / 2) % n;
+        inc.set_init_voxel(seeds[i], 0);
+    }
+    inc.march();
+    for (size_t i = 3; i < seeds.size(); ++i) {
+        ref.set_init_voxel(seeds[i], 0);
+    }
+    ref.march();
+    double error = 0;
+    fast_marching<3>::space_index s;
+    for (s[0] = 0; s[0] < n; ++s[0]) for (s[1] = 0; s[1] < n; ++s[1]) for (s[2] = 0; s[2] < n; ++s[2]) {
+        error = std::max(error, std::abs(inc.get_value(s) - ref.get_value(s)));
+    }
+    return error;
+}
+
+// sizes are 2 less than powers of two, so padded morton grids are not rounded up
+int main() {
+    for (unsigned seed = 0; seed < 10; ++seed) {
+        printf("incremental error %g, band 6: %g\n", check_incremental(30, seed, 1e9), check_incremental(30, seed, 6));
+    }
+    bench<fast_marching<2>>("2d linear", 2046, 1e9);
+    bench<fast_marching<2, double, fast_marching_morton_layout<2>>>("2d morton", 2046, 1e9);
+    bench<fast_marching<3>>("3d linear", 126, 1e9);
+    bench<fast_marching<3, double, fast_marching_brick_layout<3>>>("3d brick", 126, 1e9);
+    bench<fast_marching<3, double, fast_marching_morton_layout<3>>>("3d morton", 126, 1e9);
+    bench<sparse_fast_marching<3>>("3d sparse", 126, 1e9);
+    bench<sparse_fast_marching<3>>("3d band", 1022, 8);
+    return 0;
+}
+*/
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <thread>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+
+inline size_t parallel_thread_count() {
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+/*
+    Worker threads shared by every parallel_for_chunks() call, started on first use.
+    run() hands out task indices to the workers and the calling thread and returns when all are done.
+    The pool runs one job at a time: a call from inside a task, or from another thread
+    while a job is running, returns false and the caller runs the tasks itself.
+*/
+class parallel_pool {
+public:
+    static parallel_pool &instance() {
+        static parallel_pool pool(parallel_thread_count() - 1);
+        return pool;
+    }
+
+    ~parallel_pool() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_wake.notify_all();
+        for (size_t i = 0; i < m_workers.size(); ++i) {
+            m_workers[i].join();
+        }
+    }
+
+    bool run(size_t n_tasks, const std::function<void(size_t)> &task) {
+        if (m_workers.empty() || in_task() || !m_run_mutex.try_lock()) {
+            return false;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_task = &task;
+            m_n_tasks = n_tasks;
+            m_next = 0;
+            m_n_busy = m_workers.size();
+            m_generation++;
+        }
+        m_wake.notify_all();
+        in_task() = true;
+        drain();
+        in_task() = false;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_done.wait(lock, [this] { return m_n_busy == 0; });
+            m_task = nullptr;
+        }
+        m_run_mutex.unlock();
+        return true;
+    }
+
+private:
+    parallel_pool(size_t n_workers) {
+        m_workers.reserve(n_workers);
+        for (size_t i = 0; i < n_workers; ++i) {
+            m_workers.emplace_back([this] { work(); });
+        }
+    }
+
+    parallel_pool(const parallel_pool &) = delete;
+    parallel_pool &operator=(const parallel_pool &) = delete;
+
+    static bool &in_task() {
+        static thread_local bool flag = false;
+        return flag;
+    }
+
+    void drain() {
+        for (size_t i = m_next++; i < m_n_tasks; i = m_next++) {
+            (*m_task)(i);
+        }
+    }
+
+    void work() {
+        in_task() = true;
+        unsigned int seen = 0;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (;;) {
+            m_wake.wait(lock, [this, seen] { return m_stop || m_generation != seen; });
+            if (m_stop) {
+                return;
+            }
+            seen = m_generation;
+            lock.unlock();
+            drain();
+            lock.lock();
+            if (--m_n_busy == 0) {
+                m_done.notify_one();
+            }
+        }
+    }
+
+    std::vector<std::thread> m_workers;
+    std::mutex m_run_mutex;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    const std::function<void(size_t)> *m_task = nullptr;
+    size_t m_n_tasks = 0;
+    std::atomic<size_t> m_next{ 0 };
+    size_t m_n_busy = 0;
+    unsigned int m_generation = 0;
+    bool m_stop = false;
+};
+
+/*
+    Splits [begin, end) into at most parallel_thread_count() contiguous chunks and calls
+    f(chunk_begin, chunk_end, chunk_index) for each chunk on the threads of parallel_pool.
+    No two threads run the same chunk index at once, so it can index per thread storage.
+    Ranges shorter than 2*min_chunk, nested calls and calls made while another thread
+    holds the pool run serially. Returns when all chunks are done.
+*/
+template <typename F>
+inline void parallel_for_chunks(size_t begin, size_t end, F f, size_t min_chunk = 1024) {
+    if (end <= begin) {
+        return;
+    }
+    size_t n = end - begin;
+    size_t n_threads = std::min(parallel_thread_count(), std::max(size_t(1), n / std::max(size_t(1), min_chunk)));
+    if (n_threads <= 1) {
+        f(begin, end, size_t(0));
+        return;
+    }
+
+    size_t chunk = (n + n_threads - 1) / n_threads;
+    std::function<void(size_t)> task = [&f, begin, end, chunk](size_t t) {
+        size_t lo = std::min(end, begin + t*chunk);
+        size_t hi = std::min(end, lo + chunk);
+        f(lo, hi, t);
+    };
+    if (!parallel_pool::instance().run(n_threads, task)) {
+        for (size_t t = 0; t < n_threads; ++t) {
+            task(t);
+        }
+    }
+}
+
+/*
+    Calls f(thread_index) once on each of exactly n_threads threads, the calling thread runs index 0.
+    Unlike parallel_for_chunks the count is not capped by the number of cores.
+*/
+template <typename F>
+inline void parallel_threads(size_t n_threads, F f) {
+    std::vector<std::thread> threads;
+    threads.reserve(n_threads > 1 ? n_threads - 1 : 0);
+    for (size_t t = 1; t < n_threads; ++t) {
+        threads.emplace_back([&f, t]() {
+            f(t);
+        });
+    }
+    if (n_threads > 0) {
+        f(size_t(0));
+    }
+    for (size_t t = 0; t < threads.size(); ++t) {
+        threads[t].join();
+    }
+}
+
+// calls f(i) for every i in [begin, end)
+template <typename F>
+inline void parallel_for(size_t begin, size_t end, F f, size_t min_chunk = 1024) {
+    parallel_for_chunks(begin, end, [&f](size_t lo, size_t hi, size_t) {
+        for (size_t i = lo; i < hi; ++i) {
+            f(i);
+        }
+    }, min_chunk);
+}
+
+/*
+#include <cstdio>
+#include "parallel_for.h"
+
+int main() {
+    std::vector<double> v(10000000);
+    parallel_for(0, v.size(), [&v](size_t i) {
+        v[i] = sqrt(double(i));
+    });
+    printf("%f\n", v.back());
+    return 0;
+}
+*/
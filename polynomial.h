@@ -39,7 +39,7 @@ public:
 
     polynomial operator- () const {
         clist_type cc = m_coeffs;
-        for (clist_type::iterator it = cc.begin(); it != cc.end(); ++it) {
+        for (typename clist_type::iterator it = cc.begin(); it != cc.end(); ++it) {
             it->second = -it->second;
         }
 
@@ -48,7 +48,7 @@ public:
 
     polynomial derivative() const {
         clist_type cc;
-        for (clist_type::const_iterator it = m_coeffs.cbegin(); it != m_coeffs.cend(); ++it) {
+        for (typename clist_type::const_iterator it = m_coeffs.cbegin(); it != m_coeffs.cend(); ++it) {
             if (it->first > 0) {
                 cc[it->first - 1] = f_type(it->first)*it->second;
             }
@@ -58,7 +58,7 @@ public:
 
     polynomial operator+ (const polynomial &p) const {
         clist_type cc = p.m_coeffs;
-        for (clist_type::const_iterator it = m_coeffs.cbegin(); it != m_coeffs.cend(); ++it) {
+        for (typename clist_type::const_iterator it = m_coeffs.cbegin(); it != m_coeffs.cend(); ++it) {
             cc[it->first] += it->second;
         }
         return polynomial(std::move(cc));
@@ -70,8 +70,8 @@ public:
 
     polynomial operator* (const polynomial &p) const {
         clist_type cc;
-        for (clist_type::const_iterator ita = m_coeffs.cbegin(); ita != m_coeffs.cend(); ++ita) {
-            for (clist_type::const_iterator itb = p.m_coeffs.cbegin(); itb != p.m_coeffs.cend(); ++itb) {
+        for (typename clist_type::const_iterator ita = m_coeffs.cbegin(); ita != m_coeffs.cend(); ++ita) {
+            for (typename clist_type::const_iterator itb = p.m_coeffs.cbegin(); itb != p.m_coeffs.cend(); ++itb) {
                 cc[ita->first + itb->first] += ita->second*itb->second;
             }
         }
@@ -85,7 +85,7 @@ public:
             e_type rp = cc.crbegin()->first - cp.crbegin()->first;
             f_type s = cc.crbegin()->second / cp.crbegin()->second;
             cc.erase(cc.crbegin()->first);
-            for (clist_type::const_reverse_iterator it = (++cp.crbegin()); it != cp.crend(); ++it) {
+            for (typename clist_type::const_reverse_iterator it = (++cp.crbegin()); it != cp.crend(); ++it) {
                 e_type tp = it->first + rp;
                 cc[tp] -= s*it->second;
                 if (cc.at(tp) == f_type(0)) {
@@ -129,18 +129,21 @@ public:
         if (m_coeffs.size() > 0) {
             p = m_coeffs.crbegin()->first;
         }
-        for (clist_type::const_reverse_iterator it = m_coeffs.crbegin(); it != m_coeffs.crend(); ++it) {
+        for (typename clist_type::const_reverse_iterator it = m_coeffs.crbegin(); it != m_coeffs.crend(); ++it) {
             for (; p > it->first; --p) {
                 r *= x;
             }
             r += it->second;
         }
+        for (; p > 0; --p) {
+            r *= x;
+        }
         return r;
     }
 
 private:
     polynomial(clist_type&& m) : m_coeffs(std::move(m)) {
-        clist_type::iterator it = m_coeffs.begin();
+        typename clist_type::iterator it = m_coeffs.begin();
         while (it != m_coeffs.end()) {
             if (it->second == 0) {
                 it = m_coeffs.erase(it);
@@ -27,11 +27,14 @@ public:
     size_t sign_changes(const f_type &v) const {
         size_t count = 0;
         bool current_sign;
-        f_type current_value;
+        f_type current_value(0);
         size_t i = 0;
         while (i < m_chain.size() && ((current_value = m_chain[i](v)) == 0)) {
             ++i;
         }
+        if (i == m_chain.size()) {
+            return 0;
+        }
         current_sign = (current_value > 0);
         for (++i; i < m_chain.size(); ++i) {
             current_value = m_chain[i](v);